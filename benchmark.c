@@ -1,96 +1,717 @@
-/* Measures performance of blitter, useful for improving a custom blitter.
+/* Measures performance of library and writes results as CSV or JSON, so that
+releases can be compared. Times initialization, then blitting over a sweep of
+lores/hires, input widths, output depths, merge_fields, image contents, and
+thread counts, then with prefetching at several distances (see
+snes_ntsc_blit_prefetch()) so the best one for a processor can be found by
+comparing noisy and flat content, then exact aspect ratio (see
+snes_ntsc_exact_blit()) against the normal blitter followed by a resampling
+pass. Each configuration is run for some warmup frames, then each frame
+is timed separately and the median, 99th percentile, and slowest reported.
+Needs POSIX threads (snes_ntsc_pool.c) and snes_ntsc_exact.c.
+
 NOTE: This assumes that the process is getting 100% CPU time; you might need to
-arrange for this or else the performance will be reported lower than it really is. */
+arrange for this or else the performance will be reported lower than it really is.
+
+Usage: benchmark [options] > results.csv
+
+-json         Write JSON rather than CSV
+-frames n     Frames timed per configuration (default 200)
+-warmup n     Frames run before timing (default 20)
+-threads n    Most threads to try (default number of processors)
+-p bits       Table precision: 10, 12, 13 (default), or 15, up to
+              SNES_NTSC_MAX_PRECISION
+-in file WxH  Also use raw 16-bit RGB frames from file as input content
+
+Times are in microseconds. Rows for initialization have "init" as their test,
+the stage in the mode column, and the time in p50_us. Stage rows break down one
+init into its signal processing stages (see snes_ntsc_impl.h) and generation of
+the table. The depth column is the output depth, or bgra8888, argb8888, or
+rgb888 for those formats. Rows of the prefetch sweep
+have "prefetch" as their test; prefetch distance 0 is the normal blitter. Rows
+of the exact comparison have "exact" as their test and blit, resample, or exact
+as their mode. Comparing the init rows of builds with and without SNES_NTSC_SIMD
+shows its effect on table generation. */
+
+#define _POSIX_C_SOURCE 200112L /* for clock_gettime() */
 
 #include "snes_ntsc.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
-enum { time_hires = 0 }; /* change to 1 to time hires mode */
+enum { max_width  = 512 };
+enum { max_height = 239 };
+enum { height     = 224 };
+enum { frame_count = 8 }; /* distinct input frames cycled through */
+enum { max_out_width = SNES_NTSC_OUT_WIDTH( max_width ) };
 
-enum { in_width   = 256 * 2 };
-enum { in_height  = 223 };
+typedef struct content_t
+{
+	char const* name;
+	unsigned short* frames [frame_count];
+	int width; /* pixels per row in frames */
+} content_t;
+
+enum { max_contents = 5 };
+static content_t contents [max_contents];
+static int content_count;
+
+static snes_ntsc_t* ntsc;
+static void* out_buf;
+static double* times;
 
-enum { out_width  = SNES_NTSC_OUT_WIDTH( in_width ) };
-enum { out_height = in_height };
+static int timed_frames  = 200;
+static int warmup_frames = 20;
+static int max_threads;
+static int precision = 13;
+static int json;
+static int first_row;
 
-struct data_t
+static void fatal_error( const char* str )
 {
-	snes_ntsc_t ntsc;
-	unsigned short in  [ in_height] [ in_width];
-	unsigned short out [out_height] [out_width];
-};
+	fprintf( stderr, "Error: %s\n", str );
+	exit( EXIT_FAILURE );
+}
+
+static double now( void )
+{
+	struct timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int compare_doubles( void const* a, void const* b )
+{
+	double x = *(double const*) a;
+	double y = *(double const*) b;
+	return (x > y) - (x < y);
+}
+
+/* Time at fraction p of sorted times */
+static double percentile( double const* sorted, int count, double p )
+{
+	int i = (int) (p * count);
+	if ( i >= count )
+		i = count - 1;
+	return sorted [i];
+}
+
+/* Input content */
 
-static int time_blitter( void );
+static unsigned rand_state = 1;
+
+static unsigned next_rand( void )
+{
+	rand_state = rand_state * 1103515245 + 12345;
+	return rand_state >> 16 & 0x7FFF;
+}
+
+static unsigned short* new_frame( void )
+{
+	unsigned short* p = (unsigned short*) malloc( max_width * max_height * sizeof *p );
+	if ( !p )
+		fatal_error( "Out of memory" );
+	return p;
+}
+
+static content_t* add_content( char const* name )
+{
+	content_t* c = &contents [content_count++];
+	int f;
+	c->name  = name;
+	c->width = max_width;
+	for ( f = 0; f < frame_count; f++ )
+		c->frames [f] = new_frame();
+	return c;
+}
+
+/* Every color, which stresses the cache most */
+static void make_noise( void )
+{
+	content_t* c = add_content( "noise" );
+	int f, i;
+	for ( f = 0; f < frame_count; f++ )
+		for ( i = 0; i < max_width * max_height; i++ )
+			c->frames [f] [i] = (unsigned short) (next_rand() ^ next_rand() << 1);
+}
+
+/* Random pixels from 32 shades of green, as benchmark used to use */
+static void make_palette( void )
+{
+	content_t* c = add_content( "green" );
+	int f, i;
+	for ( f = 0; f < frame_count; f++ )
+		for ( i = 0; i < max_width * max_height; i++ )
+			c->frames [f] [i] = (unsigned short) ((next_rand() >> 4 & 0x1F) * 64);
+}
+
+/* Single color */
+static void make_flat( void )
+{
+	content_t* c = add_content( "flat" );
+	int f, i;
+	for ( f = 0; f < frame_count; f++ )
+		for ( i = 0; i < max_width * max_height; i++ )
+			c->frames [f] [i] = 0x4A69;
+}
 
-int main()
+/* Like a game screen: gradient sky behind 8x8 tiles using a few 16-color
+palettes, scrolling a bit each frame */
+static void make_tiles( void )
 {
-	struct data_t* data = (struct data_t*) malloc( sizeof *data );
-	if ( data )
+	enum { tile_count = 64 };
+	static unsigned char tiles [tile_count] [8] [8];
+	static unsigned short palettes [4] [16];
+	static unsigned char map [32] [64];
+	content_t* c = add_content( "tiles" );
+	int f, x, y, t;
+	
+	for ( t = 0; t < tile_count; t++ )
+		for ( y = 0; y < 8; y++ )
+			for ( x = 0; x < 8; x++ )
+				tiles [t] [y] [x] = (unsigned char) (t < 8 ? 0 : next_rand() % 16);
+	for ( t = 0; t < 4; t++ )
+		for ( x = 0; x < 16; x++ )
+			palettes [t] [x] = (unsigned short) next_rand();
+	for ( y = 0; y < 32; y++ )
+		for ( x = 0; x < 64; x++ )
+			map [y] [x] = (unsigned char) (y < 16 ? 0 : next_rand() % tile_count);
+	
+	for ( f = 0; f < frame_count; f++ )
 	{
-		clock_t start;
-		
-		/* fill with random pixel data */
-		int y;
-		for ( y = 0; y < in_height; y++ )
+		for ( y = 0; y < max_height; y++ )
 		{
-			int x;
-			for ( x = 0; x < in_width; x++ )
-				data->in [y] [x] = (rand() >> 4 & 0x1F) * 64;
+			unsigned short* out = c->frames [f] + y * max_width;
+			/* sky gets bluer toward top */
+			unsigned short sky = (unsigned short) ((31 - y / 8) | (y / 16) << 6);
+			for ( x = 0; x < max_width; x++ )
+			{
+				int sx = x + f * 2;
+				int tile = map [y / 8 % 32] [sx / 8 % 64];
+				int index = tiles [tile] [y % 8] [sx % 8];
+				out [x] = (index ? palettes [tile % 4] [index] : sky);
+			}
 		}
-		
-		/* time initialization */
-		start = clock();
-		for ( y = 10; y--; )
-			snes_ntsc_init( &data->ntsc, 0 );
-		printf( "Init time: %.2f seconds\n",
-				(double) (clock() - start) / (CLOCKS_PER_SEC * 10) );
-		
-		/* measure frame rate */
-		while ( time_blitter() )
+	}
+}
+
+/* Raw frames from file, repeated if there are fewer than frame_count */
+static void load_frames( char const* path, int width, int h )
+{
+	content_t* c = add_content( "file" );
+	long size = (long) width * h;
+	int loaded = 0;
+	int f;
+	FILE* in = fopen( path, "rb" );
+	if ( !in )
+		fatal_error( "Couldn't open input file" );
+	if ( width < 4 || width > max_width || h < height || h > max_height )
+		fatal_error( "Input frames must be 4 to 512 wide and 224 to 239 high" );
+	
+	c->width = width;
+	for ( f = 0; f < frame_count; f++ )
+	{
+		memset( c->frames [f], 0, max_width * max_height * sizeof (unsigned short) );
+		if ( (long) fread( c->frames [f], sizeof (unsigned short), size, in ) == size )
+			loaded++;
+		else if ( loaded )
+			memcpy( c->frames [f], c->frames [f % loaded], size * sizeof (unsigned short) );
+		else
+			fatal_error( "Input file is smaller than one frame" );
+	}
+	fclose( in );
+}
+
+/* Output */
+
+static void begin_output( void )
+{
+	if ( json )
+		printf( "{\n\t\"precision\": %d,\n\t\"results\": [\n", precision );
+	else
+		printf( "test,mode,width,depth,merge_fields,threads,prefetch,content,frames,"
+				"p50_us,p99_us,max_us,fps\n" );
+	first_row = 1;
+}
+
+static void end_output( void )
+{
+	if ( json )
+		printf( "\n\t]\n}\n" );
+}
+
+static void print_init( char const* stage, int threads, double seconds )
+{
+	if ( json )
+		printf( "%s\t\t{ \"test\": \"init\", \"stage\": \"%s\", \"threads\": %d, \"us\": %.3f }",
+				(first_row ? "" : ",\n"), stage, threads, seconds * 1e6 );
+	else
+		printf( "init,%s,,,,%d,,,1,%.3f,,,\n", stage, threads, seconds * 1e6 );
+	first_row = 0;
+	fflush( stdout );
+}
+
+/* Output depth as number, or name of format that isn't just a depth */
+static char const* depth_name( int depth )
+{
+	static char str [16];
+	if ( depth == SNES_NTSC_BGRA8888 ) return "bgra8888";
+	if ( depth == SNES_NTSC_ARGB8888 ) return "argb8888";
+	if ( depth == SNES_NTSC_RGB888   ) return "rgb888";
+	sprintf( str, "%d", depth );
+	return str;
+}
+
+static void print_blit( char const* test, char const* mode, int width, int depth, int merge,
+		int threads, int prefetch, char const* content, double const* sorted, int count,
+		double total )
+{
+	double p50 = percentile( sorted, count, 0.50 ) * 1e6;
+	double p99 = percentile( sorted, count, 0.99 ) * 1e6;
+	double max = sorted [count - 1] * 1e6;
+	double fps = count / total;
+	if ( json )
+		printf( "%s\t\t{ \"test\": \"%s\", \"mode\": \"%s\", \"width\": %d, \"depth\": \"%s\", "
+				"\"merge_fields\": %d, \"threads\": %d, \"prefetch\": %d, \"content\": \"%s\", "
+				"\"frames\": %d, \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, \"fps\": %.1f }",
+				(first_row ? "" : ",\n"), test, mode, width, depth_name( depth ), merge,
+				threads, prefetch, content, count, p50, p99, max, fps );
+	else
+		printf( "%s,%s,%d,%s,%d,%d,%d,%s,%d,%.1f,%.1f,%.1f,%.1f\n", test, mode, width,
+				depth_name( depth ), merge, threads, prefetch, content, count, p50, p99, max, fps );
+	first_row = 0;
+	fflush( stdout );
+}
+
+/* Initialization */
+
+static double time_init( snes_ntsc_setup_t const* setup, snes_ntsc_pool_t* pool,
+		snes_ntsc_setup_t const* update )
+{
+	/* best of several, since nothing about init varies */
+	double best = 1e9;
+	int n;
+	for ( n = 0; n < 5; n++ )
+	{
+		double start;
+		if ( update )
+			snes_ntsc_init( ntsc, setup );
+		start = now();
+		if ( update )
+			snes_ntsc_update( ntsc, update );
+		else if ( pool )
+			snes_ntsc_init_mt( ntsc, setup, pool );
+		else
+			snes_ntsc_init( ntsc, setup );
+		start = now() - start;
+		if ( best > start )
+			best = start;
+	}
+	return best;
+}
+
+/* Best time of one run of an init stage, which is too quick to time alone */
+static double time_stage( int stage, snes_ntsc_setup_t const* setup )
+{
+	enum { runs = 100 };
+	double best = 1e9;
+	int n;
+	snes_ntsc_init( ntsc, setup );
+	for ( n = 0; n < 5; n++ )
+	{
+		double start = now();
+		int i;
+		for ( i = 0; i < runs; i++ )
+			snes_ntsc_init_stage_( ntsc, setup, stage );
+		start = now() - start;
+		if ( best > start )
+			best = start;
+	}
+	return best / runs;
+}
+
+static void time_inits( void )
+{
+	snes_ntsc_setup_t setup = snes_ntsc_composite;
+	snes_ntsc_setup_t changed;
+	int threads;
+	setup.precision = precision;
+	
+	print_init( "init", 1, time_init( &setup, 0, 0 ) );
+	
+	/* where init's time goes; table is generated alone when only merge_fields changes */
+	print_init( "stage_artifacts", 1, time_stage( 0, &setup ) );
+	print_init( "stage_levels",    1, time_stage( 1, &setup ) );
+	print_init( "stage_filters",   1, time_stage( 2, &setup ) );
+	print_init( "stage_decoder",   1, time_stage( 3, &setup ) );
+	changed = setup;
+	changed.merge_fields = !setup.merge_fields;
+	print_init( "stage_table",     1, time_init( &setup, 0, &changed ) );
+	
+	for ( threads = 2; threads <= max_threads; threads *= 2 )
+	{
+		snes_ntsc_pool_t* pool = snes_ntsc_pool_new( threads );
+		if ( !pool )
+			fatal_error( "Couldn't create thread pool" );
+		print_init( "init_mt", threads, time_init( &setup, pool, 0 ) );
+		snes_ntsc_pool_delete( pool );
+	}
+	
+	/* update only redoes the stages affected by what changed */
+	print_init( "update_none", 1, time_init( &setup, 0, &setup ) );
+	
+	changed = setup;
+	changed.hue = 0.1;
+	print_init( "update_hue", 1, time_init( &setup, 0, &changed ) );
+	
+	changed = setup;
+	changed.sharpness = 0.5;
+	print_init( "update_sharpness", 1, time_init( &setup, 0, &changed ) );
+	
+	/* table with both merge_fields settings costs more to init but not to switch */
+	setup.both_fields = 1;
+	print_init( "init_both_fields", 1, time_init( &setup, 0, 0 ) );
+	
+	changed = setup;
+	changed.merge_fields = !setup.merge_fields;
+	print_init( "update_both_fields", 1, time_init( &setup, 0, &changed ) );
+}
+
+/* Blitting */
+
+/* Blits warmup + timed frames with blit, pool, or prefetching blitter if prefetch
+isn't zero, and records time of each timed frame */
+static void time_blit( snes_ntsc_blit_t blit, snes_ntsc_pool_t* pool, int prefetch,
+		int hires, content_t const* c, int width, int merge, int out_pitch, double* total )
+{
+	int n;
+	double start = 0;
+	for ( n = -warmup_frames; n < timed_frames; n++ )
+	{
+		unsigned short const* in = c->frames [(n + warmup_frames) % frame_count];
+		int phase = (merge ? 0 : n & 1);
+		double t;
+		if ( n == 0 )
+			start = now();
+		t = now();
+		if ( blit )
+			blit( ntsc, in, c->width, phase, width, height, out_buf, out_pitch );
+		else if ( prefetch && hires )
+			snes_ntsc_blit_hires_prefetch( ntsc, in, c->width, phase, width, height,
+					out_buf, out_pitch, prefetch );
+		else if ( prefetch )
+			snes_ntsc_blit_prefetch( ntsc, in, c->width, phase, width, height,
+					out_buf, out_pitch, prefetch );
+		else if ( hires )
+			snes_ntsc_blit_hires_mt( ntsc, pool, in, c->width, phase, width, height,
+					out_buf, out_pitch );
+		else
+			snes_ntsc_blit_mt( ntsc, pool, in, c->width, phase, width, height,
+					out_buf, out_pitch );
+		if ( n >= 0 )
+			times [n] = now() - t;
+	}
+	*total = now() - start;
+	qsort( times, timed_frames, sizeof *times, compare_doubles );
+}
+
+static void time_blits( void )
+{
+	static int const depths [] = { 14, 15, 16, 32, SNES_NTSC_BGRA8888, SNES_NTSC_ARGB8888,
+			SNES_NTSC_RGB888 };
+	snes_ntsc_setup_t setup = snes_ntsc_composite;
+	int merge;
+	setup.precision = precision;
+	
+	for ( merge = 0; merge < 2; merge++ )
+	{
+		int hires;
+		setup.merge_fields = merge;
+		snes_ntsc_init( ntsc, &setup );
+		for ( hires = 0; hires < 2; hires++ )
+		{
+			char const* mode = (hires ? "hires" : "lores");
+			int full = (hires ? 512 : 256);
+			int width;
+			for ( width = full / 2; width <= full; width *= 2 )
+			{
+				int ci;
+				for ( ci = 0; ci < content_count; ci++ )
+				{
+					content_t const* c = &contents [ci];
+					int d;
+					int threads;
+					if ( width > c->width )
+						continue;
+					
+					for ( d = 0; d < (int) (sizeof depths / sizeof *depths); d++ )
+					{
+						snes_ntsc_blit_t blit = snes_ntsc_blitter( snes_ntsc_in_rgb16, depths [d], hires );
+						double total;
+						time_blit( blit, 0, 0, hires, c, width, merge, max_out_width * 4, &total );
+						print_blit( "blit", mode, width, depths [d], merge, 1, 0, c->name,
+								times, timed_frames, total );
+					}
+					
+					/* parallel blitter uses formats in snes_ntsc_config.h */
+					for ( threads = 2; threads <= max_threads; threads *= 2 )
+					{
+						snes_ntsc_pool_t* pool = snes_ntsc_pool_new( threads );
+						double total;
+						if ( !pool )
+							fatal_error( "Couldn't create thread pool" );
+						time_blit( 0, pool, 0, hires, c, width, merge, max_out_width * 4, &total );
+						print_blit( "blit", mode, width, SNES_NTSC_OUT_DEPTH, merge, threads, 0,
+								c->name, times, timed_frames, total );
+						snes_ntsc_pool_delete( pool );
+					}
+				}
+			}
+		}
+	}
+}
+
+/* Prefetch distances in input pixels. Noisy content shows the most benefit, since
+it uses the most of the table; flat content shows the overhead. */
+static void time_prefetch( void )
+{
+	static int const distances [] = { 0, 3, 6, 12, 24, 48, 96 };
+	snes_ntsc_setup_t setup = snes_ntsc_composite;
+	int hires;
+	setup.precision = precision;
+	snes_ntsc_init( ntsc, &setup );
+	
+	for ( hires = 0; hires < 2; hires++ )
+	{
+		char const* mode = (hires ? "hires" : "lores");
+		int width = (hires ? 512 : 256);
+		int ci;
+		for ( ci = 0; ci < content_count; ci++ )
 		{
-			if ( time_hires )
-				snes_ntsc_blit_hires( &data->ntsc, data->in [0], in_width, 0,
-						in_width, in_height, data->out [0], sizeof data->out [0] );
+			content_t const* c = &contents [ci];
+			int d;
+			if ( width > c->width )
+				continue;
+			
+			/* distance of 0 is the normal blitter */
+			for ( d = 0; d < (int) (sizeof distances / sizeof *distances); d++ )
+			{
+				double total;
+				time_blit( 0, 0, distances [d], hires, c, width, 0, max_out_width * 4, &total );
+				print_blit( "prefetch", mode, width, SNES_NTSC_OUT_DEPTH, 0, 1, distances [d],
+						c->name, times, timed_frames, total );
+			}
+		}
+	}
+}
+
+/* Exact aspect ratio */
+
+/* Linear horizontal rescale of rows from in_width to out_width pixels, as a program
+would do after the normal blitter to correct its aspect ratio. Pixels are in the
+format of SNES_NTSC_OUT_DEPTH; each channel is mixed separately. */
+static void resample( void const* in, void* out, int in_width, int out_width, long pitch,
+		int rows )
+{
+	long const step = ((long) in_width << 16) / out_width;
+	for ( ; rows; --rows )
+	{
+		long pos = step / 2 - 0x8000;
+		int x;
+		for ( x = 0; x < out_width; x++ )
+		{
+			int i = (pos < 0 ? 0 : (int) (pos >> 16));
+			unsigned w = (pos < 0 ? 0 : (unsigned) (pos >> 8 & 0xFF));
+			if ( i > in_width - 2 )
+				i = in_width - 2;
+			if ( SNES_NTSC_OUT_DEPTH == SNES_NTSC_RGB888 )
+			{
+				unsigned char const* a = (unsigned char const*) in + i * 3;
+				unsigned char* o = (unsigned char*) out + x * 3;
+				int c;
+				for ( c = 0; c < 3; c++ )
+					o [c] = (unsigned char) ((a [c] * (256 - w) + a [c + 3] * w) >> 8);
+			}
+			else if ( SNES_NTSC_OUT_DEPTH <= 16 )
+			{
+				/* same masks as scanlines use, with 5-bit weight */
+				unsigned const rb = (SNES_NTSC_OUT_DEPTH == 16 ? 0xF81F : 0x7C1F);
+				unsigned const g  = (SNES_NTSC_OUT_DEPTH == 16 ? 0x07E0 : 0x03E0);
+				unsigned short const* a = (unsigned short const*) in + i;
+				unsigned w5 = w >> 3;
+				((unsigned short*) out) [x] = (unsigned short) (
+						(((a [0] & rb) * (32 - w5) + (a [1] & rb) * w5) >> 5 & rb) |
+						(((a [0] & g ) * (32 - w5) + (a [1] & g ) * w5) >> 5 & g ));
+			}
 			else
-				snes_ntsc_blit( &data->ntsc, data->in [0], in_width, 0,
-						in_width / 2, in_height, data->out [0], sizeof data->out [0] );
+			{
+				/* two channels at a time, with 8-bit weight */
+				unsigned const* a = (unsigned const*) in + i;
+				unsigned lo = (a [0]      & 0xFF00FF) * (256 - w) + (a [1]      & 0xFF00FF) * w;
+				unsigned hi = (a [0] >> 8 & 0xFF00FF) * (256 - w) + (a [1] >> 8 & 0xFF00FF) * w;
+				((unsigned*) out) [x] = (lo >> 8 & 0xFF00FF) | (hi & 0xFF00FF00);
+			}
+			pos += step;
+		}
+		in  = (char const*) in + pitch;
+		out = (char*) out + pitch;
+	}
+}
+
+/* Times snes_ntsc_exact_blit(), or normal blitter followed by resample() to the
+same width if exact is NULL */
+static void time_exact_blit( snes_ntsc_exact_t const* exact, void* resampled,
+		content_t const* c, int width, long out_pitch, double* total )
+{
+	int n;
+	double start = 0;
+	for ( n = -warmup_frames; n < timed_frames; n++ )
+	{
+		unsigned short const* in = c->frames [(n + warmup_frames) % frame_count];
+		double t;
+		if ( n == 0 )
+			start = now();
+		t = now();
+		if ( exact )
+		{
+			snes_ntsc_exact_blit( exact, in, c->width, n & 1, width, height,
+					out_buf, out_pitch );
 		}
+		else
+		{
+			snes_ntsc_blit( ntsc, in, c->width, n & 1, width, height, out_buf, out_pitch );
+			resample( out_buf, resampled, SNES_NTSC_OUT_WIDTH( width ),
+					SNES_NTSC_EXACT_OUT_WIDTH( width ), out_pitch, height );
+		}
+		if ( n >= 0 )
+			times [n] = now() - t;
+	}
+	*total = now() - start;
+	qsort( times, timed_frames, sizeof *times, compare_doubles );
+}
+
+/* Exact aspect ratio in one pass, against normal blitter alone and followed by
+the separate resampling pass it replaces */
+static void time_exact( void )
+{
+	snes_ntsc_setup_t setup = snes_ntsc_composite;
+	snes_ntsc_exact_t* exact;
+	void* resampled = malloc( max_out_width * 4 * max_height );
+	int const width = 256;
+	double start;
+	int ci;
+	if ( !resampled )
+		fatal_error( "Out of memory" );
+	setup.precision = precision;
+	snes_ntsc_init( ntsc, &setup );
+	
+	start = now();
+	exact = snes_ntsc_exact_new( &setup, 0 );
+	if ( !exact )
+		fatal_error( "Out of memory" );
+	print_init( "exact_new", 1, now() - start );
+	
+	for ( ci = 0; ci < content_count; ci++ )
+	{
+		content_t const* c = &contents [ci];
+		double total;
+		if ( width > c->width )
+			continue;
+		
+		time_blit( 0, 0, 0, 0, c, width, 0, max_out_width * 4, &total );
+		print_blit( "exact", "blit", width, SNES_NTSC_OUT_DEPTH, 0, 1, 0, c->name,
+				times, timed_frames, total );
 		
-		free( data );
+		time_exact_blit( 0, resampled, c, width, max_out_width * 4, &total );
+		print_blit( "exact", "resample", width, SNES_NTSC_OUT_DEPTH, 0, 1, 0, c->name,
+				times, timed_frames, total );
+		
+		time_exact_blit( exact, 0, c, width, max_out_width * 4, &total );
+		print_blit( "exact", "exact", width, SNES_NTSC_OUT_DEPTH, 0, 1, 0, c->name,
+				times, timed_frames, total );
 	}
 	
-	getchar();
-	return 0;
+	snes_ntsc_exact_delete( exact );
+	free( resampled );
 }
 
-static int time_blitter( void )
+int main( int argc, char** argv )
 {
-	int const duration = 4; /* seconds */
-	static clock_t end_time;
-	static int count;
-	if ( !count )
+	char const* in_path = 0;
+	int in_width = 0, in_height = 0;
+	int i;
+	
+	{
+		long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+		max_threads = (cpus > 0 ? (int) cpus : 1);
+	}
+	
+	for ( i = 1; i < argc; i++ )
 	{
-		clock_t time = clock();
-		while ( clock() == time ) { }
-		if ( clock() - time > CLOCKS_PER_SEC )
+		char const* arg = argv [i];
+		char const* value = (i + 1 < argc ? argv [i + 1] : 0);
+		if ( !strcmp( arg, "-json" ) )
 		{
-			/* clock increments less-often than once every second */
-			printf( "Insufficient time resolution\n" );
-			return 0;
+			json = 1;
+			continue;
 		}
-		end_time = clock() + CLOCKS_PER_SEC * duration;
+		if ( !value )
+			fatal_error( "Unknown option or missing value" );
+		i++;
+		if ( !strcmp( arg, "-frames" ) )
+			timed_frames = atoi( value );
+		else if ( !strcmp( arg, "-warmup" ) )
+			warmup_frames = atoi( value );
+		else if ( !strcmp( arg, "-threads" ) )
+			max_threads = atoi( value );
+		else if ( !strcmp( arg, "-p" ) )
+			precision = atoi( value );
+		else if ( !strcmp( arg, "-in" ) && i + 1 < argc )
+		{
+			in_path = value;
+			if ( sscanf( argv [++i], "%dx%d", &in_width, &in_height ) != 2 )
+				fatal_error( "Size must be WxH" );
+		}
+		else
+			fatal_error( "Unknown option" );
 	}
-	else if ( clock() >= end_time )
+	if ( timed_frames < 1 )
+		timed_frames = 1;
+	if ( warmup_frames < 0 )
+		warmup_frames = 0;
+	
+	ntsc    = (snes_ntsc_t*) malloc( sizeof *ntsc );
+	out_buf = malloc( max_out_width * 4 * max_height );
+	times   = (double*) malloc( timed_frames * sizeof *times );
+	if ( !ntsc || !out_buf || !times )
+		fatal_error( "Out of memory" );
+	
+	make_noise();
+	make_palette();
+	make_flat();
+	make_tiles();
+	if ( in_path )
+		load_frames( in_path, in_width, in_height );
+	
+	begin_output();
+	time_inits();
+	time_blits();
+	time_prefetch();
+	time_exact();
+	end_output();
+	
+	free( times );
+	free( out_buf );
+	free( ntsc );
+	for ( i = 0; i < content_count; i++ )
 	{
-		int rate = count / duration;
-		printf( "Performance: %d frames per second, which would use %d%% CPU at 60 FPS\n",
-				rate, 60 * 100 / rate );
-		return 0;
+		int f;
+		for ( f = 0; f < frame_count; f++ )
+			free( contents [i].frames [f] );
 	}
-	count++;
 	
-	return 1;
+	return 0;
 }
@@ -27,6 +27,9 @@ int main( int argc, char** argv )
 	snes_ntsc_t* ntsc = (snes_ntsc_t*) malloc( sizeof (snes_ntsc_t) );
 	if ( !ntsc )
 		fatal_error( "Out of memory" );
+	
+	/* space bar then only has to switch tables */
+	setup.both_fields = 1;
 	snes_ntsc_init( ntsc, &setup );
 	
 	load_bmp( &image, (argc > 1 ? argv [1] : "test.bmp"), 0 );
@@ -40,10 +43,9 @@ int main( int argc, char** argv )
 		if ( setup.merge_fields )
 			burst_phase = 0;
 		
-		snes_ntsc_blit( ntsc, image.rgb_16, image.row_width, burst_phase,
-				image.width, image.height, output_pixels, output_pitch );
-		
-		double_output_height();
+		/* blended scanlines darkened by 12% */
+		snes_ntsc_blit_scanlines( ntsc, image.rgb_16, image.row_width, burst_phase,
+				image.width, image.height, output_pixels, output_pitch, 0.875, 1 );
 		display_output();
 		
 		switch ( key_pressed )
@@ -59,6 +61,7 @@ int main( int argc, char** argv )
 		if ( key_pressed || mouse_moved )
 		{
 			setup.merge_fields = merge_fields;
+			setup.both_fields  = 1;
 			
 			/* available parameters: hue, saturation, contrast, brightness,
 			sharpness, gamma, bleed, resolution, artifacts, fringing */
@@ -73,7 +76,7 @@ int main( int argc, char** argv )
 				setup.decoder_matrix = matrix;
 			}
 			
-			snes_ntsc_init( ntsc, &setup );
+			snes_ntsc_update( ntsc, &setup );
 		}
 	}
 	
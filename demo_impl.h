@@ -20,7 +20,6 @@ void save_bmp( const char* path );
 void init_window( int width, int height );
 int read_input( void );
 void lock_pixels( void );
-void double_output_height( void );
 void display_output( void );
 void fatal_error( const char* str );
 
@@ -116,29 +115,6 @@ void lock_pixels( void )
 	output_pixels = (unsigned char*) surface->pixels;
 }
 
-void double_output_height( void )
-{
-	int y;
-	for ( y = surface->h / 2; --y >= 0; )
-	{
-		unsigned char const* in = output_pixels + y * output_pitch;
-		unsigned char* out = output_pixels + y * 2 * output_pitch;
-		int n;
-		for ( n = surface->w; n; --n )
-		{
-			unsigned prev = *(unsigned short*) in;
-			unsigned next = *(unsigned short*) (in + output_pitch);
-			/* mix 16-bit rgb without losing low bits */
-			unsigned mixed = prev + next + ((prev ^ next) & 0x0821);
-			/* darken by 12% */
-			*(unsigned short*) out = prev;
-			*(unsigned short*) (out + output_pitch) = (mixed >> 1) - (mixed >> 4 & 0x18E3);
-			in += 2;
-			out += 2;
-		}
-	}
-}
-
 void display_output( void )
 {
 	SDL_UnlockSurface( surface );
@@ -0,0 +1,400 @@
+/* Filters a stream of raw 16-bit RGB frames, for recording or piping to a video
+encoder. Reading, filtering, and writing run on separate threads with a ring of
+frames between them, so all three overlap. Needs POSIX threads but no display.
+
+Usage: filter [options] [in [out]]
+
+in and out default to standard input and output; "-" also means these. Input is
+raw frames, or a YUV4MPEG2 (Y4M) stream whose frames hold 16-bit RGB pixels
+instead of YUV. Pixels are in native byte order. Output is always raw frames,
+SNES_NTSC_OUT_WIDTH() pixels wide and as high as the input. Frame rate and
+other information are written to standard error.
+
+-s WxH      Size of input frames (default 256x224; Y4M header overrides)
+-f format   Input pixel format: rgb16 (default) or bgr15
+-d depth    Output depth: 14, 15, 16 (default), 24, or 32; 24 and 32 give 4
+            bytes per pixel, the others 2. Or bgra or argb (4 bytes in that
+            order, on little-endian) or rgb24 (3 bytes)
+-hires      Input is hires (typically 512 wide)
+-v video    composite (default), svideo, rgb, or monochrome
+-m          Merge fields, for less flicker (burst phase is then always 0)
+-r frames   Frames in ring between stages (default 8)
+*/
+
+#define _POSIX_C_SOURCE 200112L /* for clock_gettime() */
+
+#include "snes_ntsc.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+typedef struct slot_t
+{
+	unsigned short* in;
+	void* out;
+	int state;
+} slot_t;
+
+enum { slot_free, slot_read, slot_filtered };
+
+static struct
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t changed; /* signaled whenever anything below changes */
+	slot_t* slots;
+	int slot_count;
+	int read_all;     /* reader has reached end of input */
+	long frame_count; /* valid once read_all is set */
+	int failed;
+} ring;
+
+static FILE* in_file;
+static FILE* out_file;
+static int in_width  = 256;
+static int in_height = 224;
+static long in_size;  /* bytes per input frame */
+static long out_size; /* bytes per output frame */
+
+static void fatal_error( const char* str )
+{
+	fprintf( stderr, "Error: %s\n", str );
+	exit( EXIT_FAILURE );
+}
+
+static double now( void )
+{
+	struct timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Waits until slot for frame n is in given state. Returns NULL if there won't be
+a frame n or another stage failed. */
+static slot_t* wait_slot( long n, int state )
+{
+	slot_t* s = &ring.slots [n % ring.slot_count];
+	pthread_mutex_lock( &ring.mutex );
+	while ( s->state != state && !ring.failed && !(ring.read_all && n >= ring.frame_count) )
+		pthread_cond_wait( &ring.changed, &ring.mutex );
+	if ( s->state != state || ring.failed )
+		s = 0;
+	pthread_mutex_unlock( &ring.mutex );
+	return s;
+}
+
+static void set_state( slot_t* s, int state )
+{
+	pthread_mutex_lock( &ring.mutex );
+	s->state = state;
+	pthread_cond_broadcast( &ring.changed );
+	pthread_mutex_unlock( &ring.mutex );
+}
+
+static void stop( long frame_count, int failed )
+{
+	pthread_mutex_lock( &ring.mutex );
+	if ( frame_count >= 0 )
+	{
+		ring.frame_count = frame_count;
+		ring.read_all = 1;
+	}
+	ring.failed |= failed;
+	pthread_cond_broadcast( &ring.changed );
+	pthread_mutex_unlock( &ring.mutex );
+}
+
+/* Y4M */
+
+static int is_y4m;
+static char first_bytes [10]; /* read to check for Y4M, otherwise start of first frame */
+static int first_count;
+
+static int read_line( char* out, int size )
+{
+	int n = 0;
+	int c;
+	while ( (c = getc( in_file )) != EOF && c != '\n' )
+	{
+		if ( n < size - 1 )
+			out [n++] = (char) c;
+	}
+	out [n] = 0;
+	return c != EOF;
+}
+
+static void read_header( void )
+{
+	first_count = (int) fread( first_bytes, 1, sizeof first_bytes, in_file );
+	if ( first_count == (int) sizeof first_bytes && !memcmp( first_bytes, "YUV4MPEG2 ", 10 ) )
+	{
+		char line [256];
+		char* p;
+		is_y4m = 1;
+		first_count = 0;
+		if ( !read_line( line, sizeof line ) )
+			fatal_error( "Y4M header is truncated" );
+		
+		/* parameters are separated by spaces and start with a letter */
+		for ( p = strtok( line, " " ); p; p = strtok( 0, " " ) )
+		{
+			if ( *p == 'W' )
+				in_width = atoi( p + 1 );
+			else if ( *p == 'H' )
+				in_height = atoi( p + 1 );
+		}
+	}
+}
+
+/* Reads next frame into out. Returns 1 if read, 0 at end of input or read
+error, or -1 if input is bad. */
+static int read_frame( unsigned short* out )
+{
+	char* p = (char*) out;
+	long size = in_size;
+	long got;
+	if ( is_y4m )
+	{
+		char line [256];
+		if ( !read_line( line, sizeof line ) )
+			return 0;
+		if ( strncmp( line, "FRAME", 5 ) )
+		{
+			fprintf( stderr, "Error: Y4M frame header missing\n" );
+			return -1;
+		}
+	}
+	else if ( first_count )
+	{
+		/* bytes read while checking for Y4M */
+		memcpy( p, first_bytes, first_count );
+		p += first_count;
+		size -= first_count;
+		first_count = 0;
+	}
+	
+	got = (long) fread( p, 1, size, in_file );
+	if ( got != size )
+	{
+		if ( !ferror( in_file ) && (got || is_y4m || p != (char*) out) )
+			fprintf( stderr, "Warning: Ignoring partial frame at end of input\n" );
+		return 0;
+	}
+	return 1;
+}
+
+/* Stages */
+
+static void* reader( void* arg )
+{
+	long n;
+	int result = 0;
+	(void) arg;
+	for ( n = 0; ; n++ )
+	{
+		slot_t* s = wait_slot( n, slot_free );
+		if ( !s || (result = read_frame( s->in )) <= 0 )
+			break;
+		set_state( s, slot_read );
+	}
+	if ( ferror( in_file ) )
+	{
+		fprintf( stderr, "Error: couldn't read input\n" );
+		result = -1;
+	}
+	stop( n, result < 0 );
+	return 0;
+}
+
+static void* writer( void* arg )
+{
+	long n;
+	(void) arg;
+	for ( n = 0; ; n++ )
+	{
+		slot_t* s = wait_slot( n, slot_filtered );
+		if ( !s )
+			break;
+		if ( fwrite( s->out, out_size, 1, out_file ) != 1 )
+		{
+			fprintf( stderr, "Error: couldn't write output\n" );
+			stop( -1, 1 );
+			break;
+		}
+		set_state( s, slot_free );
+	}
+	return 0;
+}
+
+static snes_ntsc_setup_t const* video_setup( char const* name )
+{
+	if ( !strcmp( name, "composite"  ) ) return &snes_ntsc_composite;
+	if ( !strcmp( name, "svideo"     ) ) return &snes_ntsc_svideo;
+	if ( !strcmp( name, "rgb"        ) ) return &snes_ntsc_rgb;
+	if ( !strcmp( name, "monochrome" ) ) return &snes_ntsc_monochrome;
+	fatal_error( "Unknown video type" );
+	return 0;
+}
+
+static int out_format( char const* name )
+{
+	if ( !strcmp( name, "bgra"  ) ) return SNES_NTSC_BGRA8888;
+	if ( !strcmp( name, "argb"  ) ) return SNES_NTSC_ARGB8888;
+	if ( !strcmp( name, "rgb24" ) ) return SNES_NTSC_RGB888;
+	return atoi( name );
+}
+
+int main( int argc, char** argv )
+{
+	snes_ntsc_setup_t setup = snes_ntsc_composite;
+	int in_format = snes_ntsc_in_rgb16;
+	int out_depth = 16;
+	int hires = 0;
+	int merge_fields = 0;
+	int slot_count = 8;
+	char const* in_path  = "-";
+	char const* out_path = "-";
+	int path_count = 0;
+	int out_width;
+	long out_pitch;
+	snes_ntsc_blit_t blit;
+	snes_ntsc_t* ntsc;
+	pthread_t read_thread, write_thread;
+	double start, elapsed;
+	long n;
+	int i;
+	
+	for ( i = 1; i < argc; i++ )
+	{
+		char const* arg = argv [i];
+		char const* value = (i + 1 < argc ? argv [i + 1] : 0);
+		if ( !strcmp( arg, "-hires" ) )
+			hires = 1;
+		else if ( !strcmp( arg, "-m" ) )
+			merge_fields = 1;
+		else if ( arg [0] == '-' && arg [1] && !arg [2] && strchr( "sfdvr", arg [1] ) )
+		{
+			if ( !value )
+				fatal_error( "Option needs a value" );
+			i++;
+			switch ( arg [1] )
+			{
+				case 's':
+					if ( sscanf( value, "%dx%d", &in_width, &in_height ) != 2 )
+						fatal_error( "Size must be WxH" );
+					break;
+				case 'f':
+					if ( !strcmp( value, "rgb16" ) )
+						in_format = snes_ntsc_in_rgb16;
+					else if ( !strcmp( value, "bgr15" ) )
+						in_format = snes_ntsc_in_bgr15;
+					else
+						fatal_error( "Format must be rgb16 or bgr15" );
+					break;
+				case 'd': out_depth = out_format( value ); break;
+				case 'v': setup = *video_setup( value ); break;
+				case 'r': slot_count = atoi( value ); break;
+			}
+		}
+		else if ( arg [0] == '-' && arg [1] )
+			fatal_error( "Unknown option" );
+		else if ( path_count == 0 )
+			in_path = argv [i], path_count++;
+		else if ( path_count == 1 )
+			out_path = argv [i], path_count++;
+		else
+			fatal_error( "Too many files" );
+	}
+	
+	blit = snes_ntsc_blitter( in_format, out_depth, hires );
+	if ( !blit )
+		fatal_error( "Unsupported output depth" );
+	if ( slot_count < 2 )
+		slot_count = 2;
+	
+	in_file  = (strcmp( in_path,  "-" ) ? fopen( in_path,  "rb" ) : stdin);
+	out_file = (strcmp( out_path, "-" ) ? fopen( out_path, "wb" ) : stdout);
+	if ( !in_file )
+		fatal_error( "Couldn't open input file" );
+	if ( !out_file )
+		fatal_error( "Couldn't create output file" );
+	
+	read_header();
+	if ( in_width < (hires ? 8 : 4) || in_height < 1 )
+		fatal_error( "Frame size is too small" );
+	
+	/* hires blitter generates same width from twice as many pixels */
+	out_width = SNES_NTSC_OUT_WIDTH( hires ? in_width / 2 : in_width );
+	out_pitch = out_width * (out_depth <= 16 ? 2 : out_depth == SNES_NTSC_RGB888 ? 3 : 4);
+	in_size   = (long) in_width * in_height * sizeof (unsigned short);
+	out_size  = out_pitch * in_height;
+	
+	/* table */
+	ntsc = (snes_ntsc_t*) malloc( sizeof *ntsc );
+	if ( !ntsc )
+		fatal_error( "Out of memory" );
+	setup.merge_fields = merge_fields;
+	start = now();
+	snes_ntsc_init( ntsc, &setup );
+	fprintf( stderr, "Init: %.3f seconds\n", now() - start );
+	fprintf( stderr, "Output: %dx%d, %ld bytes per row\n", out_width, in_height, out_pitch );
+	
+	/* ring */
+	ring.slot_count = slot_count;
+	ring.slots = (slot_t*) calloc( slot_count, sizeof *ring.slots );
+	if ( !ring.slots )
+		fatal_error( "Out of memory" );
+	for ( i = 0; i < slot_count; i++ )
+	{
+		ring.slots [i].in  = (unsigned short*) malloc( in_size );
+		ring.slots [i].out = malloc( out_size );
+		if ( !ring.slots [i].in || !ring.slots [i].out )
+			fatal_error( "Out of memory" );
+	}
+	pthread_mutex_init( &ring.mutex, 0 );
+	pthread_cond_init( &ring.changed, 0 );
+	
+	start = now();
+	if ( pthread_create( &read_thread, 0, reader, 0 ) ||
+			pthread_create( &write_thread, 0, writer, 0 ) )
+		fatal_error( "Couldn't start threads" );
+	
+	/* filter on this thread */
+	for ( n = 0; ; n++ )
+	{
+		slot_t* s = wait_slot( n, slot_read );
+		if ( !s )
+			break;
+		
+		/* toggle between frames unless fields are merged */
+		blit( ntsc, s->in, in_width, (merge_fields ? 0 : (int) (n & 1)),
+				in_width, in_height, s->out, out_pitch );
+		
+		set_state( s, slot_filtered );
+	}
+	
+	pthread_join( read_thread, 0 );
+	pthread_join( write_thread, 0 );
+	elapsed = now() - start;
+	
+	if ( fflush( out_file ) )
+		ring.failed = 1;
+	fprintf( stderr, "Filtered %ld frames in %.2f seconds: %.1f frames per second\n",
+			n, elapsed, (elapsed > 0 ? n / elapsed : 0.0) );
+	
+	for ( i = 0; i < slot_count; i++ )
+	{
+		free( ring.slots [i].in );
+		free( ring.slots [i].out );
+	}
+	free( ring.slots );
+	free( ntsc );
+	if ( in_file != stdin )
+		fclose( in_file );
+	if ( out_file != stdout && fclose( out_file ) )
+		ring.failed = 1;
+	
+	return (ring.failed ? EXIT_FAILURE : 0);
+}
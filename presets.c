@@ -0,0 +1,192 @@
+/* Writes snes_ntsc_presets.c, which holds the tables of the four video presets
+already generated, so that snes_ntsc_preset() can return one with no
+initialization at all. Run it as a step of your build, compiled with the same
+snes_ntsc_config.h and for the same platform as the library, then compile its
+output into the library or program. Tables are stored as they are in memory,
+only as many entries as the precision uses, and aren't compressed, since
+uncompressing would cost about as much as generating them.
+
+Usage: presets [options] [preset ...] > snes_ntsc_presets.c
+
+preset      composite, svideo, rgb, or monochrome (default all four)
+-p bits     Table precision: 10, 12, 13 (default), or 15, up to
+            SNES_NTSC_MAX_PRECISION. Each table takes 0.5, 2, 4, or 16 MB
+            respectively, and about 2.5 times that as source code.
+*/
+
+#include "snes_ntsc.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+typedef struct preset_t
+{
+	char const* name;
+	snes_ntsc_setup_t const* setup;
+	int wanted;
+} preset_t;
+
+static preset_t presets [4] = {
+	{ "composite",  &snes_ntsc_composite,  0 },
+	{ "svideo",     &snes_ntsc_svideo,     0 },
+	{ "rgb",        &snes_ntsc_rgb,        0 },
+	{ "monochrome", &snes_ntsc_monochrome, 0 }
+};
+
+#if SNES_NTSC_LAZY
+	enum { lazy = 1 };
+#else
+	enum { lazy = 0 };
+#endif
+
+#if SNES_NTSC_ALIGNED
+	enum { aligned = 1 };
+	
+	/* SIMD blitters can load past end of last line */
+	enum { extra_size = snes_ntsc_line_size * 2 };
+#else
+	enum { aligned = 0 };
+	enum { extra_size = 0 };
+#endif
+
+static void fatal_error( const char* str )
+{
+	fprintf( stderr, "Error: %s\n", str );
+	exit( EXIT_FAILURE );
+}
+
+/* Values of ntsc stored, laid out as in table files */
+static size_t stored_size( int precision )
+{
+	return SNES_NTSC_STORED_SIZE_( precision, 0 ) / sizeof (snes_ntsc_rgb_t) + extra_size;
+}
+
+static void write_header( int precision )
+{
+	printf( "/* Generated by presets.c; don't edit. Tables are at %d-bit precision. */\n\n",
+			precision );
+	printf( "#include \"snes_ntsc.h\"\n\n" );
+	printf( "#include <stddef.h>\n\n" );
+	
+	/* tables are only valid for library with same configuration and layout */
+	printf( "#if !SNES_NTSC_LAZY != %d || !SNES_NTSC_ALIGNED != %d\n", !lazy, !aligned );
+	printf( "\t#error \"snes_ntsc_presets.c was generated for different configuration\"\n" );
+	printf( "#endif\n\n" );
+	printf( "typedef char snes_ntsc_presets_match [offsetof (snes_ntsc_t, table) == %lu &&\n",
+			(unsigned long) offsetof (snes_ntsc_t, table) );
+	printf( "\t\tsizeof (snes_ntsc_rgb_t) == %lu ? 1 : -1];\n\n",
+			(unsigned long) sizeof (snes_ntsc_rgb_t) );
+	
+	#if SNES_NTSC_ALIGNED
+		printf( "/* table's lines must be on 64-byte boundaries */\n" );
+		printf( "#if defined (__GNUC__)\n" );
+		printf( "\t#define PRESET_ALIGN __attribute__ ((aligned (64)))\n" );
+		printf( "#elif defined (_MSC_VER)\n" );
+		printf( "\t#define PRESET_ALIGN __declspec (align (64))\n" );
+		printf( "#else\n" );
+		printf( "\t#error \"Need way to align data to 64 bytes\"\n" );
+		printf( "#endif\n\n" );
+	#else
+		printf( "#define PRESET_ALIGN\n\n" );
+	#endif
+	
+	printf( "typedef union preset_t\n{\n" );
+	printf( "\tsnes_ntsc_rgb_t data [%lu];\n", (unsigned long) stored_size( precision ) );
+	printf( "\tdouble align; /* at least as aligned as snes_ntsc_t */\n" );
+	printf( "\tlong align_long;\n" );
+	printf( "\tvoid* align_ptr;\n" );
+	printf( "} preset_t;\n" );
+}
+
+static void write_preset( snes_ntsc_t* ntsc, preset_t const* p, int precision )
+{
+	snes_ntsc_setup_t setup = *p->setup;
+	snes_ntsc_rgb_t const* in = (snes_ntsc_rgb_t const*) ntsc;
+	size_t count = stored_size( precision );
+	size_t n;
+	
+	/* unused bytes are stored too, so make them the same every time */
+	memset( ntsc, 0, sizeof *ntsc + 64 );
+	setup.precision = precision;
+	snes_ntsc_init( ntsc, &setup );
+	#if SNES_NTSC_LAZY
+		/* stored table can't be modified later */
+		for ( n = 0; n < (size_t) 1 << precision; n++ )
+			snes_ntsc_build_entry_( ntsc, (int) n );
+	#endif
+	
+	printf( "\nstatic PRESET_ALIGN preset_t const %s = {{", p->name );
+	for ( n = 0; n < count; n++ )
+		printf( "%s0x%lX,", (n % 8 ? "" : "\n"), (unsigned long) in [n] );
+	printf( "\n}};\n" );
+	fprintf( stderr, "%s: %lu bytes\n", p->name, (unsigned long) (count * sizeof *in) );
+}
+
+static void write_lookup( void )
+{
+	int i;
+	printf( "\nsnes_ntsc_t const* snes_ntsc_preset( snes_ntsc_setup_t const* setup )\n{\n" );
+	printf( "\tif ( !setup )\n" );
+	printf( "\t\tsetup = &snes_ntsc_composite;\n" );
+	for ( i = 0; i < 4; i++ )
+	{
+		if ( presets [i].wanted )
+		{
+			/* copy of a preset, or precision of 0, still matches */
+			printf( "\tif ( snes_ntsc_same_setup_( (snes_ntsc_t const*) &%s, setup ) )\n",
+					presets [i].name );
+			printf( "\t\treturn (snes_ntsc_t const*) &%s;\n", presets [i].name );
+		}
+	}
+	printf( "\treturn 0;\n}\n" );
+}
+
+int main( int argc, char** argv )
+{
+	int precision = 13;
+	int any = 0;
+	void* mem;
+	snes_ntsc_t* ntsc;
+	int i;
+	
+	for ( i = 1; i < argc; i++ )
+	{
+		if ( !strcmp( argv [i], "-p" ) && i + 1 < argc )
+		{
+			precision = atoi( argv [++i] );
+			if ( precision != 10 && precision != 12 && precision != 13 && precision != 15 )
+				fatal_error( "Precision must be 10, 12, 13, or 15" );
+			if ( precision > SNES_NTSC_MAX_PRECISION )
+				fatal_error( "Precision is above SNES_NTSC_MAX_PRECISION" );
+		}
+		else
+		{
+			int n;
+			for ( n = 0; n < 4 && strcmp( argv [i], presets [n].name ); n++ ) { }
+			if ( n >= 4 )
+				fatal_error( "Usage: presets [-p bits] [composite] [svideo] [rgb] [monochrome]" );
+			presets [n].wanted = 1;
+			any = 1;
+		}
+	}
+	for ( i = 0; i < 4 && !any; i++ )
+		presets [i].wanted = 1;
+	
+	/* generated at same alignment as stored, so table falls at same place; at
+	SNES_NTSC_MAX_PRECISION, extra values stored go up to 64 bytes past end */
+	mem = malloc( sizeof *ntsc + 63 + 64 );
+	if ( !mem )
+		fatal_error( "Out of memory" );
+	ntsc = (snes_ntsc_t*) ((char*) mem + (-(size_t) mem & 63));
+	
+	write_header( precision );
+	for ( i = 0; i < 4; i++ )
+		if ( presets [i].wanted )
+			write_preset( ntsc, &presets [i], precision );
+	write_lookup();
+	
+	free( mem );
+	return 0;
+}
@@ -2,6 +2,8 @@
 
 #include "snes_ntsc.h"
 
+#include <string.h>
+
 /* Copyright (C) 2006-2007 Shay Green. This module is free software; you
 can redistribute it and/or modify it under the terms of the GNU Lesser
 General Public License as published by the Free Software Foundation; either
@@ -13,10 +15,10 @@ details. You should have received a copy of the GNU Lesser General Public
 License along with this module; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
 
-snes_ntsc_setup_t const snes_ntsc_monochrome = { 0,-1, 0, 0,.2,  0,.2,-.2,-.2,-1,  1, 0, 0 };
-snes_ntsc_setup_t const snes_ntsc_composite  = { 0, 0, 0, 0, 0,  0, 0,  0,  0, 0,  1, 0, 0 };
-snes_ntsc_setup_t const snes_ntsc_svideo     = { 0, 0, 0, 0,.2,  0,.2, -1, -1, 0,  1, 0, 0 };
-snes_ntsc_setup_t const snes_ntsc_rgb        = { 0, 0, 0, 0,.2,  0,.7, -1, -1,-1,  1, 0, 0 };
+snes_ntsc_setup_t const snes_ntsc_monochrome = { 0,-1, 0, 0,.2,  0,.2,-.2,-.2,-1,  1, 0, 0, 0, 0 };
+snes_ntsc_setup_t const snes_ntsc_composite  = { 0, 0, 0, 0, 0,  0, 0,  0,  0, 0,  1, 0, 0, 0, 0 };
+snes_ntsc_setup_t const snes_ntsc_svideo     = { 0, 0, 0, 0,.2,  0,.2, -1, -1, 0,  1, 0, 0, 0, 0 };
+snes_ntsc_setup_t const snes_ntsc_rgb        = { 0, 0, 0, 0,.2,  0,.7, -1, -1,-1,  1, 0, 0, 0, 0 };
 
 #define alignment_count 3
 #define burst_count     3
@@ -39,25 +41,49 @@ pixel_info_t const snes_ntsc_pixels [alignment_count] = {
 	{ PIXEL_OFFSET(  0, -5 ), {                  0, .6667f, 1, 1 } },
 };
 
-static void merge_kernel_fields( snes_ntsc_rgb_t* io )
+#if SNES_NTSC_SIMD && !DISABLE_CORRECTION
+
+/* Same as below, for i = 0 to 3 then 4 to 6 (and an unused 7th). No value read
+for one i is written for another, so they can be done at once. */
+#define CORRECT_LOAD( i )   _mm_loadu_si128( (__m128i const*) (out + (i)) )
+#define CORRECT_ADD( i, v ) _mm_storeu_si128( (__m128i*) (out + (i)),\
+		_mm_add_epi32( CORRECT_LOAD( i ), v ) )
+
+#define CORRECT_ERRORS( i, wrap1, wrap2, used ) {\
+	__m128i error = _mm_sub_epi32( _mm_sub_epi32( _mm_sub_epi32( _mm_sub_epi32(\
+			_mm_sub_epi32( _mm_sub_epi32( color_, CORRECT_LOAD( i ) ), wrap1 ), wrap2 ),\
+			CORRECT_LOAD( i + 7 ) ), CORRECT_LOAD( i + 5 + 14 ) ), CORRECT_LOAD( i + 3 + 28 ) );\
+	__m128i fourth = _mm_sub_epi32( _mm_and_si128( _mm_srli_epi32(\
+			_mm_add_epi32( error, round ), 2 ), mask ), bias );\
+	error = _mm_and_si128( error, used );\
+	fourth = _mm_and_si128( fourth, used );\
+	CORRECT_ADD( i + 3 + 28, fourth );\
+	CORRECT_ADD( i + 5 + 14, fourth );\
+	CORRECT_ADD( i + 7, fourth );\
+	CORRECT_ADD( i, _mm_sub_epi32( error, _mm_add_epi32( _mm_add_epi32( fourth, fourth ), fourth ) ) );\
+}
+
+static void correct_errors( snes_ntsc_rgb_t color, snes_ntsc_rgb_t* out )
 {
+	__m128i const color_ = _mm_set1_epi32( (int) color );
+	__m128i const round  = _mm_set1_epi32( 2 * snes_ntsc_rgb_builder );
+	__m128i const mask   = _mm_set1_epi32( (rgb_bias >> 1) - snes_ntsc_rgb_builder );
+	__m128i const bias   = _mm_set1_epi32( rgb_bias >> 2 );
+	__m128i const all    = _mm_set1_epi32( -1 );
+	__m128i const first3 = _mm_setr_epi32( -1, -1, -1, 0 );
 	int n;
-	for ( n = burst_size; n; --n )
+	for ( n = burst_count; n; --n )
 	{
-		snes_ntsc_rgb_t p0 = io [burst_size * 0] + rgb_bias;
-		snes_ntsc_rgb_t p1 = io [burst_size * 1] + rgb_bias;
-		snes_ntsc_rgb_t p2 = io [burst_size * 2] + rgb_bias;
-		/* merge colors without losing precision */
-		io [burst_size * 0] =
-				((p0 + p1 - ((p0 ^ p1) & snes_ntsc_rgb_builder)) >> 1) - rgb_bias;
-		io [burst_size * 1] =
-				((p1 + p2 - ((p1 ^ p2) & snes_ntsc_rgb_builder)) >> 1) - rgb_bias;
-		io [burst_size * 2] =
-				((p2 + p0 - ((p2 ^ p0) & snes_ntsc_rgb_builder)) >> 1) - rgb_bias;
-		++io;
+		/* (i+12)%14+14 is 26, 27, 14, 15 for first four */
+		CORRECT_ERRORS( 0, _mm_unpacklo_epi64( _mm_loadl_epi64( (__m128i const*) (out + 26) ),
+				_mm_loadl_epi64( (__m128i const*) (out + 14) ) ), CORRECT_LOAD( 38 ), all );
+		CORRECT_ERRORS( 4, CORRECT_LOAD( 16 ), CORRECT_LOAD( 28 ), first3 );
+		out += alignment_count * rgb_kernel_size;
 	}
 }
 
+#else
+
 static void correct_errors( snes_ntsc_rgb_t color, snes_ntsc_rgb_t* out )
 {
 	int n;
@@ -75,177 +101,639 @@ static void correct_errors( snes_ntsc_rgb_t color, snes_ntsc_rgb_t* out )
 	}
 }
 
-void snes_ntsc_init( snes_ntsc_t* ntsc, snes_ntsc_setup_t const* setup )
+#endif
+
+int snes_ntsc_merge_fields_( snes_ntsc_setup_t const* setup )
 {
-	int merge_fields;
-	int entry;
-	init_t impl;
-	if ( !setup )
-		setup = &snes_ntsc_composite;
-	init( &impl, setup );
-	
-	merge_fields = setup->merge_fields;
 	if ( setup->artifacts <= -1 && setup->fringing <= -1 )
-		merge_fields = 1;
+		return 1;
+	return setup->merge_fields;
+}
+
+int snes_ntsc_precision_( snes_ntsc_setup_t const* setup )
+{
+	int precision = 13;
+	if ( setup->precision == 10 || setup->precision == 12 || setup->precision == 15 )
+		precision = setup->precision;
+	if ( precision > SNES_NTSC_MAX_PRECISION )
+		precision = SNES_NTSC_MAX_PRECISION;
+	return precision;
+}
+
+/* table only has room for both variants below its maximum precision */
+int snes_ntsc_both_fields_( snes_ntsc_setup_t const* setup )
+{
+	return setup->both_fields && snes_ntsc_precision_( setup ) < SNES_NTSC_MAX_PRECISION;
+}
+
+static void set_index( snes_ntsc_index_t* index, snes_ntsc_saved_t const* saved )
+{
+	int const precision = saved->precision;
+	int const rb = RED_BITS( precision );
+	int const gb = GREEN_BITS( precision );
+	int const bb = BLUE_BITS( precision );
+	#if SNES_NTSC_ALIGNED
+		int const entry_bits = 6; /* log2 of bytes per line */
+		index->group = (long) (snes_ntsc_line_size * sizeof (snes_ntsc_rgb_t)) <<
+				(precision + saved->both_fields);
+	#else
+		int const entry_bits = 9; /* log2 of bytes per entry */
+	#endif
+	
+	/* merged entries follow unmerged ones */
+	index->variant = 0;
+	if ( saved->both_fields && saved->merge_fields )
+		index->variant = 1L << (entry_bits + precision);
+	
+	index->mask [0] = ((1 << rb) - 1) << (entry_bits + gb + bb);
+	index->mask [1] = ((1 << gb) - 1) << (entry_bits + bb);
+	index->mask [2] = ((1 << bb) - 1) << entry_bits;
+	
+	/* top bits of each component are moved to their place in offset; RGB16 has
+	components at 11, 5, and 0 and BGR15 has them at 0, 5, and 10 */
+	index->rgb16 [0] = (unsigned char) (entry_bits + gb + bb - (16 - rb));
+	index->rgb16 [1] = (unsigned char) (entry_bits + bb - (11 - gb));
+	index->rgb16 [2] = (unsigned char) (entry_bits - (5 - bb));
+	index->bgr15 [0] = (unsigned char) (entry_bits + gb + bb - (5 - rb));
+	index->bgr15 [1] = (unsigned char) (entry_bits + bb - (10 - gb));
+	index->bgr15 [2] = (unsigned char) ((15 - bb) - entry_bits);
+}
+
+/* Generates table entry for one color. If merged isn't NULL, out gets unmerged
+entry and merged gets merged one, regardless of merge_fields. */
+static void gen_entry( snes_ntsc_saved_t const* saved, int entry, snes_ntsc_rgb_t* out,
+		snes_ntsc_rgb_t* merged )
+{
+	init_t const* impl = (init_t const*) saved->impl;
+	int const rb = RED_BITS( saved->precision );
+	int const gb = GREEN_BITS( saved->precision );
+	int const bb = BLUE_BITS( saved->precision );
+	
+	/* Reduce number of significant bits of source color. Clearing the
+	low bits of R and B were least notictable. Modifying green was too
+	noticeable. */
+	int ir = (entry >> (gb + bb) & ((1 << rb) - 1)) << (5 - rb);
+	int ig = (entry >>       bb  & ((1 << gb) - 1)) << (5 - gb);
+	int ib = (entry              & ((1 << bb) - 1)) << (5 - bb);
+	
+	#if SNES_NTSC_BSNES_COLORTBL
+		if ( saved->setup.bsnes_colortbl )
+		{
+			int bgr15 = (ib << 10) | (ig << 5) | ir;
+			unsigned long rgb16 = saved->setup.bsnes_colortbl [bgr15];
+			ir = rgb16 >> 11 & (0x1F << (5 - rb) & 0x1F);
+			ig = rgb16 >>  6 & (0x1F << (5 - gb) & 0x1F);
+			ib = rgb16       & (0x1F << (5 - bb) & 0x1F);
+		}
+	#endif
 	
-	for ( entry = 0; entry < snes_ntsc_palette_size; entry++ )
-	{
-		/* Reduce number of significant bits of source color. Clearing the
-		low bits of R and B were least notictable. Modifying green was too
-		noticeable. */
-		int ir = entry >> 8 & 0x1E;
-		int ig = entry >> 4 & 0x1F;
-		int ib = entry << 1 & 0x1E;
+	{
+		float rr = impl->to_float [ir];
+		float gg = impl->to_float [ig];
+		float bb = impl->to_float [ib];
 		
-		#if SNES_NTSC_BSNES_COLORTBL
-			if ( setup->bsnes_colortbl )
-			{
-				int bgr15 = (ib << 10) | (ig << 5) | ir;
-				unsigned long rgb16 = setup->bsnes_colortbl [bgr15];
-				ir = rgb16 >> 11 & 0x1E;
-				ig = rgb16 >>  6 & 0x1F;
-				ib = rgb16       & 0x1E;
-			}
-		#endif
+		float y, i, q = RGB_TO_YIQ( rr, gg, bb, y, i );
 		
+		int r, g, b = YIQ_TO_RGB( y, i, q, impl->to_rgb, int, r, g );
+		snes_ntsc_rgb_t rgb = PACK_RGB( r, g, b );
+		
+		gen_kernel( impl, y, i, q, out );
+		if ( merged )
+		{
+			/* kernel is the slow part, so both share it */
+			memcpy( merged, out, snes_ntsc_entry_size * sizeof *out );
+			merge_kernel_fields( merged, burst_size );
+			correct_errors( rgb, merged );
+		}
+		else if ( saved->merge_fields )
 		{
-			float rr = impl.to_float [ir];
-			float gg = impl.to_float [ig];
-			float bb = impl.to_float [ib];
-			
-			float y, i, q = RGB_TO_YIQ( rr, gg, bb, y, i );
-			
-			int r, g, b = YIQ_TO_RGB( y, i, q, impl.to_rgb, int, r, g );
-			snes_ntsc_rgb_t rgb = PACK_RGB( r, g, b );
-			
-			snes_ntsc_rgb_t* out = ntsc->table [entry];
-			gen_kernel( &impl, y, i, q, out );
-			if ( merge_fields )
-				merge_kernel_fields( out );
-			correct_errors( rgb, out );
+			merge_kernel_fields( out, burst_size );
 		}
+		correct_errors( rgb, out );
 	}
 }
 
-#ifndef SNES_NTSC_NO_BLITTERS
+#if SNES_NTSC_ALIGNED
+/* Spreads each burst's alignments of entry over their tables */
+static void store_entry( snes_ntsc_t* ntsc, int entry, snes_ntsc_rgb_t const* kernel )
+{
+	snes_ntsc_rgb_t* table = (snes_ntsc_rgb_t*) SNES_NTSC_TABLE_( ntsc );
+	long const group = ntsc->index.group / (long) sizeof (snes_ntsc_rgb_t);
+	int n;
+	for ( n = 0; n < burst_count * alignment_count; n++ )
+	{
+		snes_ntsc_rgb_t* out = table + n * group + (long) entry * snes_ntsc_line_size;
+		memcpy( out, kernel + n * snes_ntsc_group_size,
+				snes_ntsc_group_size * sizeof *out );
+		memset( out + snes_ntsc_group_size, 0,
+				(snes_ntsc_line_size - snes_ntsc_group_size) * sizeof *out );
+	}
+}
+#endif
+
+/* Generates entry and stores it in table */
+static void build_entry( snes_ntsc_t* ntsc, int entry )
+{
+	int const merged = entry + (ntsc->saved.both_fields << ntsc->saved.precision);
+	#if SNES_NTSC_ALIGNED
+		snes_ntsc_rgb_t kernel [snes_ntsc_entry_size];
+		snes_ntsc_rgb_t kernel_merged [snes_ntsc_entry_size];
+		gen_entry( &ntsc->saved, entry, kernel,
+				(ntsc->saved.both_fields ? kernel_merged : 0) );
+		store_entry( ntsc, entry, kernel );
+		if ( ntsc->saved.both_fields )
+			store_entry( ntsc, merged, kernel_merged );
+	#else
+		gen_entry( &ntsc->saved, entry, ntsc->table [entry],
+				(ntsc->saved.both_fields ? ntsc->table [merged] : 0) );
+	#endif
+}
+
+typedef struct init_band_t
+{
+	snes_ntsc_t* ntsc;
+	int band_size;
+	int entry_count;
+} init_band_t;
+
+static void init_band( void* data, int index )
+{
+	init_band_t const* b = (init_band_t const*) data;
+	int entry = index * b->band_size;
+	int end = entry + b->band_size;
+	if ( end > b->entry_count )
+		end = b->entry_count;
+	for ( ; entry < end; entry++ )
+		build_entry( b->ntsc, entry );
+}
+
+/* Generates table from saved state */
+static void gen_table( snes_ntsc_t* ntsc, snes_ntsc_pool_t* pool )
+{
+	int const entry_count = 1 << ntsc->saved.precision;
+	#if SNES_NTSC_LAZY
+		/* entries are generated when a blitter first uses them */
+		set_index( &ntsc->index, &ntsc->saved );
+		memset( ntsc->built, snes_ntsc_entry_empty, entry_count );
+		(void) pool;
+		(void) init_band;
+	#else
+		int band_count = (pool ? pool->thread_count : 1);
+		init_band_t b;
+		set_index( &ntsc->index, &ntsc->saved );
+		b.ntsc        = ntsc;
+		b.entry_count = entry_count;
+		b.band_size   = (entry_count + band_count - 1) / band_count;
+		if ( band_count > 1 )
+			pool->run( pool, init_band, &b, band_count );
+		else
+			init_band( &b, 0 );
+	#endif
+}
+
+/* saved state must fit in snes_ntsc_saved_t */
+typedef char snes_ntsc_impl_fits [sizeof (init_t) <= sizeof ((snes_ntsc_t*) 0)->saved.impl ? 1 : -1];
 
-void snes_ntsc_blit( snes_ntsc_t const* ntsc, SNES_NTSC_IN_T const* input, long in_row_width,
-		int burst_phase, int in_width, int in_height, void* rgb_out, long out_pitch )
+static void save_setup( snes_ntsc_saved_t* saved, snes_ntsc_setup_t const* setup )
 {
-	int chunk_count = (in_width - 1) / snes_ntsc_in_chunk;
-	for ( ; in_height; --in_height )
+	saved->setup = *setup;
+	if ( setup->decoder_matrix )
 	{
-		SNES_NTSC_IN_T const* line_in = input;
-		SNES_NTSC_BEGIN_ROW( ntsc, burst_phase,
-				snes_ntsc_black, snes_ntsc_black, SNES_NTSC_ADJ_IN( *line_in ) );
-		snes_ntsc_out_t* restrict line_out = (snes_ntsc_out_t*) rgb_out;
-		int n;
-		++line_in;
-		
-		for ( n = chunk_count; n; --n )
-		{
-			/* order of input and output pixels must not be altered */
-			SNES_NTSC_COLOR_IN( 0, SNES_NTSC_ADJ_IN( line_in [0] ) );
-			SNES_NTSC_RGB_OUT( 0, line_out [0], SNES_NTSC_OUT_DEPTH );
-			SNES_NTSC_RGB_OUT( 1, line_out [1], SNES_NTSC_OUT_DEPTH );
-			
-			SNES_NTSC_COLOR_IN( 1, SNES_NTSC_ADJ_IN( line_in [1] ) );
-			SNES_NTSC_RGB_OUT( 2, line_out [2], SNES_NTSC_OUT_DEPTH );
-			SNES_NTSC_RGB_OUT( 3, line_out [3], SNES_NTSC_OUT_DEPTH );
-			
-			SNES_NTSC_COLOR_IN( 2, SNES_NTSC_ADJ_IN( line_in [2] ) );
-			SNES_NTSC_RGB_OUT( 4, line_out [4], SNES_NTSC_OUT_DEPTH );
-			SNES_NTSC_RGB_OUT( 5, line_out [5], SNES_NTSC_OUT_DEPTH );
-			SNES_NTSC_RGB_OUT( 6, line_out [6], SNES_NTSC_OUT_DEPTH );
-			
-			line_in  += 3;
-			line_out += 7;
-		}
-		
-		/* finish final pixels */
-		SNES_NTSC_COLOR_IN( 0, snes_ntsc_black );
-		SNES_NTSC_RGB_OUT( 0, line_out [0], SNES_NTSC_OUT_DEPTH );
-		SNES_NTSC_RGB_OUT( 1, line_out [1], SNES_NTSC_OUT_DEPTH );
-		
-		SNES_NTSC_COLOR_IN( 1, snes_ntsc_black );
-		SNES_NTSC_RGB_OUT( 2, line_out [2], SNES_NTSC_OUT_DEPTH );
-		SNES_NTSC_RGB_OUT( 3, line_out [3], SNES_NTSC_OUT_DEPTH );
-		
-		SNES_NTSC_COLOR_IN( 2, snes_ntsc_black );
-		SNES_NTSC_RGB_OUT( 4, line_out [4], SNES_NTSC_OUT_DEPTH );
-		SNES_NTSC_RGB_OUT( 5, line_out [5], SNES_NTSC_OUT_DEPTH );
-		SNES_NTSC_RGB_OUT( 6, line_out [6], SNES_NTSC_OUT_DEPTH );
-		
-		burst_phase = (burst_phase + 1) % snes_ntsc_burst_count;
-		input += in_row_width;
-		rgb_out = (char*) rgb_out + out_pitch;
+		/* caller might change matrix in place later */
+		memcpy( saved->decoder, setup->decoder_matrix, sizeof saved->decoder );
+		saved->setup.decoder_matrix = saved->decoder;
+	}
+	saved->merge_fields = snes_ntsc_merge_fields_( setup );
+	saved->precision = snes_ntsc_precision_( setup );
+	saved->both_fields = snes_ntsc_both_fields_( setup );
+}
+
+void snes_ntsc_init_mt( snes_ntsc_t* ntsc, snes_ntsc_setup_t const* setup,
+		snes_ntsc_pool_t* pool )
+{
+	if ( !setup )
+		setup = &snes_ntsc_composite;
+	init( (init_t*) ntsc->saved.impl, setup );
+	gather_taps( (init_t*) ntsc->saved.impl );
+	save_setup( &ntsc->saved, setup );
+	gen_table( ntsc, pool );
+}
+
+void snes_ntsc_init( snes_ntsc_t* ntsc, snes_ntsc_setup_t const* setup )
+{
+	snes_ntsc_init_mt( ntsc, setup, 0 );
+}
+
+static int same_decoder( float const* x, float const* y )
+{
+	if ( !x || !y )
+		return x == y;
+	return !memcmp( x, y, sizeof (float) * 6 );
+}
+
+void snes_ntsc_init_stage_( snes_ntsc_t* ntsc, snes_ntsc_setup_t const* setup, int stage )
+{
+	init_t* impl = (init_t*) ntsc->saved.impl;
+	switch ( stage )
+	{
+		case 0: init_artifacts( impl, setup ); break;
+		case 1: init_levels( impl, setup ); break;
+		case 2: init_filters( impl, setup ); gather_taps( impl ); break;
+		case 3: init_decoder( impl, setup ); break;
 	}
 }
 
-void snes_ntsc_blit_hires( snes_ntsc_t const* ntsc, SNES_NTSC_IN_T const* input, long in_row_width,
-		int burst_phase, int in_width, int in_height, void* rgb_out, long out_pitch )
+void snes_ntsc_update_mt( snes_ntsc_t* ntsc, snes_ntsc_setup_t const* setup,
+		snes_ntsc_pool_t* pool )
 {
-	int chunk_count = (in_width - 2) / (snes_ntsc_in_chunk * 2);
-	for ( ; in_height; --in_height )
+	snes_ntsc_setup_t const* old = &ntsc->saved.setup;
+	int changed = 0;
+	if ( !setup )
+		setup = &snes_ntsc_composite;
+	
+	/* redo only the init stages whose parameters changed */
+	if ( setup->artifacts != old->artifacts || setup->fringing != old->fringing )
 	{
-		SNES_NTSC_IN_T const* line_in = input;
-		SNES_NTSC_HIRES_ROW( ntsc, burst_phase,
-				snes_ntsc_black, snes_ntsc_black, snes_ntsc_black,
-				SNES_NTSC_ADJ_IN( line_in [0] ),
-				SNES_NTSC_ADJ_IN( line_in [1] ) );
-		snes_ntsc_out_t* restrict line_out = (snes_ntsc_out_t*) rgb_out;
-		int n;
-		line_in += 2;
-		
-		for ( n = chunk_count; n; --n )
+		snes_ntsc_init_stage_( ntsc, setup, 0 );
+		changed = 1;
+	}
+	
+	if ( setup->brightness != old->brightness || setup->contrast != old->contrast ||
+			setup->gamma != old->gamma )
+	{
+		snes_ntsc_init_stage_( ntsc, setup, 1 );
+		changed = 1;
+	}
+	
+	if ( setup->sharpness != old->sharpness || setup->resolution != old->resolution ||
+			setup->bleed != old->bleed )
+	{
+		snes_ntsc_init_stage_( ntsc, setup, 2 );
+		changed = 1;
+	}
+	
+	if ( setup->hue != old->hue || setup->saturation != old->saturation ||
+			!same_decoder( setup->decoder_matrix, old->decoder_matrix ) )
+	{
+		snes_ntsc_init_stage_( ntsc, setup, 3 );
+		changed = 1;
+	}
+	
+	if ( snes_ntsc_precision_( setup ) != ntsc->saved.precision ||
+			snes_ntsc_both_fields_( setup ) != ntsc->saved.both_fields ||
+			setup->bsnes_colortbl != old->bsnes_colortbl )
+		changed = 1;
+	
+	if ( snes_ntsc_merge_fields_( setup ) != ntsc->saved.merge_fields && !ntsc->saved.both_fields )
+		changed = 1;
+	
+	if ( changed )
+	{
+		save_setup( &ntsc->saved, setup );
+		gen_table( ntsc, pool );
+	}
+	else if ( snes_ntsc_merge_fields_( setup ) != ntsc->saved.merge_fields )
+	{
+		/* table already has entries for new setting */
+		save_setup( &ntsc->saved, setup );
+		set_index( &ntsc->index, &ntsc->saved );
+	}
+}
+
+void snes_ntsc_update( snes_ntsc_t* ntsc, snes_ntsc_setup_t const* setup )
+{
+	snes_ntsc_update_mt( ntsc, setup, 0 );
+}
+
+int snes_ntsc_same_setup_( snes_ntsc_t const* ntsc, snes_ntsc_setup_t const* setup )
+{
+	snes_ntsc_setup_t const* old = &ntsc->saved.setup;
+	return setup->hue == old->hue && setup->saturation == old->saturation &&
+			setup->contrast == old->contrast && setup->brightness == old->brightness &&
+			setup->sharpness == old->sharpness && setup->gamma == old->gamma &&
+			setup->resolution == old->resolution && setup->artifacts == old->artifacts &&
+			setup->fringing == old->fringing && setup->bleed == old->bleed &&
+			same_decoder( setup->decoder_matrix, old->decoder_matrix ) &&
+			setup->bsnes_colortbl == old->bsnes_colortbl &&
+			snes_ntsc_merge_fields_( setup ) == ntsc->saved.merge_fields &&
+			snes_ntsc_precision_( setup ) == ntsc->saved.precision &&
+			snes_ntsc_both_fields_( setup ) == ntsc->saved.both_fields;
+}
+
+#if SNES_NTSC_LAZY
+
+#if defined (__GNUC__)
+	#define CLAIM_ENTRY( p ) \
+		__sync_bool_compare_and_swap( p, snes_ntsc_entry_empty, snes_ntsc_entry_building )
+	#define STORE_RELEASE( p, n ) __atomic_store_n( p, n, __ATOMIC_RELEASE )
+#elif defined (_MSC_VER)
+	#include <intrin.h>
+	#define CLAIM_ENTRY( p ) (_InterlockedCompareExchange8( (char volatile*) (p),\
+		snes_ntsc_entry_building, snes_ntsc_entry_empty ) == snes_ntsc_entry_empty)
+	#define STORE_RELEASE( p, n ) (*(unsigned char volatile*) (p) = (n))
+#else
+	/* not safe to blit from more than one thread at once */
+	#define CLAIM_ENTRY( p ) (*(p) = snes_ntsc_entry_building)
+	#define STORE_RELEASE( p, n ) (*(p) = (n))
+#endif
+
+int snes_ntsc_build_entry_( snes_ntsc_t const* ntsc, int entry )
+{
+	/* table is only written where no blitter has read yet */
+	unsigned char* built = (unsigned char*) &ntsc->built [entry];
+	if ( CLAIM_ENTRY( built ) )
+	{
+		build_entry( (snes_ntsc_t*) ntsc, entry );
+		STORE_RELEASE( built, snes_ntsc_entry_built );
+	}
+	else
+	{
+		/* another thread is generating it */
+		while ( SNES_NTSC_LOAD_ACQUIRE_( built ) != snes_ntsc_entry_built ) { }
+	}
+	return 1;
+}
+
+#endif
+
+#ifndef SNES_NTSC_NO_BLITTERS
+
+#if SNES_NTSC_SIMD
+	#include "snes_ntsc_simd.h"
+#endif
+
+/* Built-in blitters, using formats in snes_ntsc_config.h */
+#define BLIT_NAME        snes_ntsc_blit
+#define BLIT_HIRES_NAME  snes_ntsc_blit_hires
+#define BLIT_LINKAGE
+#define BLIT_IN_T        SNES_NTSC_IN_T
+#define BLIT_ADJ_IN( in ) SNES_NTSC_ADJ_IN( in )
+#define BLIT_IN_FORMAT   SNES_NTSC_IN_FORMAT
+#define BLIT_OUT_DEPTH   SNES_NTSC_OUT_DEPTH
+#include "snes_ntsc_blit.h"
+
+#define BLIT_NAME        snes_ntsc_blit_scanlines
+#define BLIT_HIRES_NAME  snes_ntsc_blit_hires_scanlines
+#define BLIT_IN_FORMAT   SNES_NTSC_IN_FORMAT
+#define BLIT_OUT_DEPTH   SNES_NTSC_OUT_DEPTH
+#define BLIT_SCANLINES   1
+#include "snes_ntsc_blit.h"
+
+#define BLIT_NAME        snes_ntsc_blit_prefetch
+#define BLIT_HIRES_NAME  snes_ntsc_blit_hires_prefetch
+#define BLIT_IN_FORMAT   SNES_NTSC_IN_FORMAT
+#define BLIT_OUT_DEPTH   SNES_NTSC_OUT_DEPTH
+#define BLIT_PREFETCH    1
+#include "snes_ntsc_blit.h"
+#undef BLIT_LINKAGE
+#undef BLIT_IN_T
+#undef BLIT_ADJ_IN
+
+/* Blitters for snes_ntsc_blitter(), one for each combination of formats */
+#define BLIT_LINKAGE     static
+#define BLIT_IN_T        unsigned short
+#define BLIT_ADJ_IN( in ) in
+
+#define BLIT_NAME        blit_rgb16_14
+#define BLIT_HIRES_NAME  blit_hires_rgb16_14
+#define BLIT_IN_FORMAT   SNES_NTSC_RGB16
+#define BLIT_OUT_DEPTH   14
+#include "snes_ntsc_blit.h"
+
+#define BLIT_NAME        blit_rgb16_15
+#define BLIT_HIRES_NAME  blit_hires_rgb16_15
+#define BLIT_IN_FORMAT   SNES_NTSC_RGB16
+#define BLIT_OUT_DEPTH   15
+#include "snes_ntsc_blit.h"
+
+#define BLIT_NAME        blit_rgb16_16
+#define BLIT_HIRES_NAME  blit_hires_rgb16_16
+#define BLIT_IN_FORMAT   SNES_NTSC_RGB16
+#define BLIT_OUT_DEPTH   16
+#include "snes_ntsc_blit.h"
+
+#define BLIT_NAME        blit_rgb16_32
+#define BLIT_HIRES_NAME  blit_hires_rgb16_32
+#define BLIT_IN_FORMAT   SNES_NTSC_RGB16
+#define BLIT_OUT_DEPTH   32
+#include "snes_ntsc_blit.h"
+
+#define BLIT_NAME        blit_bgr15_14
+#define BLIT_HIRES_NAME  blit_hires_bgr15_14
+#define BLIT_IN_FORMAT   SNES_NTSC_BGR15
+#define BLIT_OUT_DEPTH   14
+#include "snes_ntsc_blit.h"
+
+#define BLIT_NAME        blit_bgr15_15
+#define BLIT_HIRES_NAME  blit_hires_bgr15_15
+#define BLIT_IN_FORMAT   SNES_NTSC_BGR15
+#define BLIT_OUT_DEPTH   15
+#include "snes_ntsc_blit.h"
+
+#define BLIT_NAME        blit_bgr15_16
+#define BLIT_HIRES_NAME  blit_hires_bgr15_16
+#define BLIT_IN_FORMAT   SNES_NTSC_BGR15
+#define BLIT_OUT_DEPTH   16
+#include "snes_ntsc_blit.h"
+
+#define BLIT_NAME        blit_bgr15_32
+#define BLIT_HIRES_NAME  blit_hires_bgr15_32
+#define BLIT_IN_FORMAT   SNES_NTSC_BGR15
+#define BLIT_OUT_DEPTH   32
+#include "snes_ntsc_blit.h"
+
+#define BLIT_NAME        blit_rgb16_bgra
+#define BLIT_HIRES_NAME  blit_hires_rgb16_bgra
+#define BLIT_IN_FORMAT   SNES_NTSC_RGB16
+#define BLIT_OUT_DEPTH   SNES_NTSC_BGRA8888
+#include "snes_ntsc_blit.h"
+
+#define BLIT_NAME        blit_rgb16_argb
+#define BLIT_HIRES_NAME  blit_hires_rgb16_argb
+#define BLIT_IN_FORMAT   SNES_NTSC_RGB16
+#define BLIT_OUT_DEPTH   SNES_NTSC_ARGB8888
+#include "snes_ntsc_blit.h"
+
+#define BLIT_NAME        blit_rgb16_rgb888
+#define BLIT_HIRES_NAME  blit_hires_rgb16_rgb888
+#define BLIT_IN_FORMAT   SNES_NTSC_RGB16
+#define BLIT_OUT_DEPTH   SNES_NTSC_RGB888
+#include "snes_ntsc_blit.h"
+
+#define BLIT_NAME        blit_bgr15_bgra
+#define BLIT_HIRES_NAME  blit_hires_bgr15_bgra
+#define BLIT_IN_FORMAT   SNES_NTSC_BGR15
+#define BLIT_OUT_DEPTH   SNES_NTSC_BGRA8888
+#include "snes_ntsc_blit.h"
+
+#define BLIT_NAME        blit_bgr15_argb
+#define BLIT_HIRES_NAME  blit_hires_bgr15_argb
+#define BLIT_IN_FORMAT   SNES_NTSC_BGR15
+#define BLIT_OUT_DEPTH   SNES_NTSC_ARGB8888
+#include "snes_ntsc_blit.h"
+
+#define BLIT_NAME        blit_bgr15_rgb888
+#define BLIT_HIRES_NAME  blit_hires_bgr15_rgb888
+#define BLIT_IN_FORMAT   SNES_NTSC_BGR15
+#define BLIT_OUT_DEPTH   SNES_NTSC_RGB888
+#include "snes_ntsc_blit.h"
+
+snes_ntsc_blit_t snes_ntsc_blitter( int in_format, int out_depth, int hires )
+{
+	static snes_ntsc_blit_t const blitters [2] [2] [7] = {
+		{
+			{ blit_rgb16_14, blit_rgb16_15, blit_rgb16_16, blit_rgb16_32,
+					blit_rgb16_bgra, blit_rgb16_argb, blit_rgb16_rgb888 },
+			{ blit_hires_rgb16_14, blit_hires_rgb16_15, blit_hires_rgb16_16, blit_hires_rgb16_32,
+					blit_hires_rgb16_bgra, blit_hires_rgb16_argb, blit_hires_rgb16_rgb888 }
+		},
 		{
-			/* twice as many input pixels per chunk */
-			SNES_NTSC_COLOR_IN( 0, SNES_NTSC_ADJ_IN( line_in [0] ) );
-			SNES_NTSC_HIRES_OUT( 0, line_out [0], SNES_NTSC_OUT_DEPTH );
-			
-			SNES_NTSC_COLOR_IN( 1, SNES_NTSC_ADJ_IN( line_in [1] ) );
-			SNES_NTSC_HIRES_OUT( 1, line_out [1], SNES_NTSC_OUT_DEPTH );
-			
-			SNES_NTSC_COLOR_IN( 2, SNES_NTSC_ADJ_IN( line_in [2] ) );
-			SNES_NTSC_HIRES_OUT( 2, line_out [2], SNES_NTSC_OUT_DEPTH );
-			
-			SNES_NTSC_COLOR_IN( 3, SNES_NTSC_ADJ_IN( line_in [3] ) );
-			SNES_NTSC_HIRES_OUT( 3, line_out [3], SNES_NTSC_OUT_DEPTH );
-			
-			SNES_NTSC_COLOR_IN( 4, SNES_NTSC_ADJ_IN( line_in [4] ) );
-			SNES_NTSC_HIRES_OUT( 4, line_out [4], SNES_NTSC_OUT_DEPTH );
-			
-			SNES_NTSC_COLOR_IN( 5, SNES_NTSC_ADJ_IN( line_in [5] ) );
-			SNES_NTSC_HIRES_OUT( 5, line_out [5], SNES_NTSC_OUT_DEPTH );
-			SNES_NTSC_HIRES_OUT( 6, line_out [6], SNES_NTSC_OUT_DEPTH );
-			
-			line_in  += 6;
-			line_out += 7;
+			{ blit_bgr15_14, blit_bgr15_15, blit_bgr15_16, blit_bgr15_32,
+					blit_bgr15_bgra, blit_bgr15_argb, blit_bgr15_rgb888 },
+			{ blit_hires_bgr15_14, blit_hires_bgr15_15, blit_hires_bgr15_16, blit_hires_bgr15_32,
+					blit_hires_bgr15_bgra, blit_hires_bgr15_argb, blit_hires_bgr15_rgb888 }
 		}
+	};
+	int depth;
+	switch ( out_depth )
+	{
+		case 14: depth = 0; break;
+		case 15: depth = 1; break;
+		case 16: depth = 2; break;
+		case 24:
+		case 32: depth = 3; break;
+		case SNES_NTSC_BGRA8888: depth = 4; break;
+		case SNES_NTSC_ARGB8888: depth = 5; break;
+		case SNES_NTSC_RGB888:   depth = 6; break;
+		default: return 0;
+	}
+	if ( in_format != snes_ntsc_in_rgb16 && in_format != snes_ntsc_in_bgr15 )
+		return 0;
+	return blitters [in_format] [hires != 0] [depth];
+}
+
+void snes_ntsc_blit_mixed( snes_ntsc_t const* ntsc, SNES_NTSC_IN_T const* input,
+		long in_row_width, int burst_phase, int in_width, int in_height,
+		unsigned char const* hires, void* rgb_out, long out_pitch )
+{
+	/* blit each run of rows in the same mode with one call */
+	int row = 0;
+	while ( row < in_height )
+	{
+		int mode = (hires [row] != 0);
+		int end = row + 1;
+		while ( end < in_height && (hires [end] != 0) == mode )
+			end++;
 		
-		SNES_NTSC_COLOR_IN( 0, snes_ntsc_black );
-		SNES_NTSC_HIRES_OUT( 0, line_out [0], SNES_NTSC_OUT_DEPTH );
-		
-		SNES_NTSC_COLOR_IN( 1, snes_ntsc_black );
-		SNES_NTSC_HIRES_OUT( 1, line_out [1], SNES_NTSC_OUT_DEPTH );
-		
-		SNES_NTSC_COLOR_IN( 2, snes_ntsc_black );
-		SNES_NTSC_HIRES_OUT( 2, line_out [2], SNES_NTSC_OUT_DEPTH );
-		
-		SNES_NTSC_COLOR_IN( 3, snes_ntsc_black );
-		SNES_NTSC_HIRES_OUT( 3, line_out [3], SNES_NTSC_OUT_DEPTH );
-		
-		SNES_NTSC_COLOR_IN( 4, snes_ntsc_black );
-		SNES_NTSC_HIRES_OUT( 4, line_out [4], SNES_NTSC_OUT_DEPTH );
-		
-		SNES_NTSC_COLOR_IN( 5, snes_ntsc_black );
-		SNES_NTSC_HIRES_OUT( 5, line_out [5], SNES_NTSC_OUT_DEPTH );
-		SNES_NTSC_HIRES_OUT( 6, line_out [6], SNES_NTSC_OUT_DEPTH );
-		
-		burst_phase = (burst_phase + 1) % snes_ntsc_burst_count;
-		input += in_row_width;
-		rgb_out = (char*) rgb_out + out_pitch;
+		if ( mode )
+			snes_ntsc_blit_hires( ntsc, input + row * in_row_width, in_row_width,
+					(burst_phase + row) % snes_ntsc_burst_count, in_width * 2, end - row,
+					(char*) rgb_out + row * out_pitch, out_pitch );
+		else
+			snes_ntsc_blit( ntsc, input + row * in_row_width, in_row_width,
+					(burst_phase + row) % snes_ntsc_burst_count, in_width, end - row,
+					(char*) rgb_out + row * out_pitch, out_pitch );
+		row = end;
+	}
+}
+
+/* parallel blitters */
+
+typedef void (*blit_func_t)( snes_ntsc_t const*, SNES_NTSC_IN_T const*, long, int,
+		int, int, void*, long );
+
+typedef struct band_t
+{
+	blit_func_t blit;
+	snes_ntsc_t const* ntsc;
+	SNES_NTSC_IN_T const* input;
+	long in_row_width;
+	int burst_phase;
+	int in_width;
+	int in_height;
+	void* rgb_out;
+	long out_pitch;
+	unsigned char const* hires; /* if not NULL, rows are blitted with snes_ntsc_blit_mixed() */
+	int band_height;
+} band_t;
+
+static void blit_band( void* data, int index )
+{
+	band_t const* b = (band_t const*) data;
+	int row = index * b->band_height;
+	int height = b->in_height - row;
+	if ( height > b->band_height )
+		height = b->band_height;
+	if ( height > 0 && b->hires )
+		snes_ntsc_blit_mixed( b->ntsc, b->input + row * b->in_row_width, b->in_row_width,
+				(b->burst_phase + row) % snes_ntsc_burst_count, b->in_width, height,
+				b->hires + row, (char*) b->rgb_out + row * b->out_pitch, b->out_pitch );
+	else if ( height > 0 )
+		b->blit( b->ntsc, b->input + row * b->in_row_width, b->in_row_width,
+				(b->burst_phase + row) % snes_ntsc_burst_count, b->in_width, height,
+				(char*) b->rgb_out + row * b->out_pitch, b->out_pitch );
+}
+
+static void blit_bands( blit_func_t blit, snes_ntsc_t const* ntsc, snes_ntsc_pool_t* pool,
+		SNES_NTSC_IN_T const* input, long in_row_width, int burst_phase,
+		int in_width, int in_height, unsigned char const* hires,
+		void* rgb_out, long out_pitch )
+{
+	int band_count = (pool ? pool->thread_count : 1);
+	if ( band_count > in_height )
+		band_count = in_height;
+	
+	if ( band_count <= 1 && hires )
+	{
+		snes_ntsc_blit_mixed( ntsc, input, in_row_width, burst_phase, in_width, in_height,
+				hires, rgb_out, out_pitch );
+	}
+	else if ( band_count <= 1 )
+	{
+		blit( ntsc, input, in_row_width, burst_phase, in_width, in_height,
+				rgb_out, out_pitch );
 	}
+	else
+	{
+		band_t b;
+		b.blit         = blit;
+		b.ntsc         = ntsc;
+		b.input        = input;
+		b.in_row_width = in_row_width;
+		b.burst_phase  = burst_phase;
+		b.in_width     = in_width;
+		b.in_height    = in_height;
+		b.rgb_out      = rgb_out;
+		b.out_pitch    = out_pitch;
+		b.hires        = hires;
+		b.band_height  = (in_height + band_count - 1) / band_count;
+		pool->run( pool, blit_band, &b, band_count );
+	}
+}
+
+void snes_ntsc_blit_mt( snes_ntsc_t const* ntsc, snes_ntsc_pool_t* pool,
+		SNES_NTSC_IN_T const* input, long in_row_width, int burst_phase,
+		int in_width, int in_height, void* rgb_out, long out_pitch )
+{
+	blit_bands( snes_ntsc_blit, ntsc, pool, input, in_row_width, burst_phase,
+			in_width, in_height, 0, rgb_out, out_pitch );
+}
+
+void snes_ntsc_blit_hires_mt( snes_ntsc_t const* ntsc, snes_ntsc_pool_t* pool,
+		SNES_NTSC_IN_T const* input, long in_row_width, int burst_phase,
+		int in_width, int in_height, void* rgb_out, long out_pitch )
+{
+	blit_bands( snes_ntsc_blit_hires, ntsc, pool, input, in_row_width, burst_phase,
+			in_width, in_height, 0, rgb_out, out_pitch );
+}
+
+void snes_ntsc_blit_mixed_mt( snes_ntsc_t const* ntsc, snes_ntsc_pool_t* pool,
+		SNES_NTSC_IN_T const* input, long in_row_width, int burst_phase,
+		int in_width, int in_height, unsigned char const* hires,
+		void* rgb_out, long out_pitch )
+{
+	blit_bands( snes_ntsc_blit, ntsc, pool, input, in_row_width, burst_phase,
+			in_width, in_height, hires, rgb_out, out_pitch );
 }
 
 #endif
@@ -5,6 +5,8 @@
 #define SNES_NTSC_H
 
 #include "snes_ntsc_config.h"
+#include <limits.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 	extern "C" {
@@ -31,6 +33,19 @@ typedef struct snes_ntsc_setup_t
 	float const* decoder_matrix; /* optional RGB decoder matrix, 6 elements */
 	
 	unsigned long const* bsnes_colortbl; /* undocumented; set to 0 */
+	
+	/* Bits of each input color used to select table entry: 12 (4-4-4 RGB), 13
+	(4-5-4), or 15 (5-5-5). Table uses 2, 4, or 16 MB respectively. 0 = 13. 10
+	(3-4-3) gives a 512KB table with visible banding that generates 8 times
+	faster than at 13, for previews while parameters are being adjusted. Limited
+	to SNES_NTSC_MAX_PRECISION in snes_ntsc_config.h. */
+	int precision;
+	
+	/* If 1, table holds entries for both merge_fields settings, so that changing
+	only merge_fields with snes_ntsc_update() doesn't regenerate table. Doubles
+	memory used by table. Ignored unless precision is below
+	SNES_NTSC_MAX_PRECISION. */
+	int both_fields;
 } snes_ntsc_setup_t;
 
 /* Video format presets */
@@ -44,6 +59,11 @@ snes_ntsc_t object. Can pass NULL for either parameter. */
 typedef struct snes_ntsc_t snes_ntsc_t;
 void snes_ntsc_init( snes_ntsc_t* ntsc, snes_ntsc_setup_t const* setup );
 
+/* Same as snes_ntsc_init(), but only redoes the work that depends on parameters
+that differ from those ntsc was last initialized with, and does nothing if none
+do. Ntsc must have been initialized with snes_ntsc_init() already. */
+void snes_ntsc_update( snes_ntsc_t* ntsc, snes_ntsc_setup_t const* setup );
+
 /* Filters one or more rows of pixels. Input pixel format is set by SNES_NTSC_IN_FORMAT
 and output RGB depth is set by SNES_NTSC_OUT_DEPTH. Both default to 16-bit RGB.
 In_row_width is the number of pixels to get to the next input row. Out_pitch
@@ -56,6 +76,242 @@ void snes_ntsc_blit_hires( snes_ntsc_t const* ntsc, SNES_NTSC_IN_T const* input,
 		long in_row_width, int burst_phase, int in_width, int in_height,
 		void* rgb_out, long out_pitch );
 
+/* Filters image whose rows are a mix of low-res and high-res, as when a game
+switches modes mid-frame. Hires has one byte per row, non-zero for rows to be
+filtered with snes_ntsc_blit_hires(). In_width is the low-res width; high-res rows
+are in_width * 2 pixels, so in_row_width must allow for that. Both kinds of row
+come out SNES_NTSC_OUT_WIDTH( in_width ) pixels wide. */
+void snes_ntsc_blit_mixed( snes_ntsc_t const* ntsc, SNES_NTSC_IN_T const* input,
+		long in_row_width, int burst_phase, int in_width, int in_height,
+		unsigned char const* hires, void* rgb_out, long out_pitch );
+
+/* Same as snes_ntsc_blit() and snes_ntsc_blit_hires(), but doubles output height
+in the same pass, as needed for correct aspect ratio. Each filtered row is followed
+by a scanline row with brightness scanline_level (0.0 = black, 1.0 = same as
+filtered row; steps of 1/32 for 16-bit output and 1/256 for 32-bit). Levels of
+1 - 1/2^n such as 0.875 are fastest. If blend is non-zero, scanline is the
+average of the rows above and below it rather than a copy of the row above.
+Writes in_height * 2 rows. */
+void snes_ntsc_blit_scanlines( snes_ntsc_t const* ntsc, SNES_NTSC_IN_T const* input,
+		long in_row_width, int burst_phase, int in_width, int in_height,
+		void* rgb_out, long out_pitch, double scanline_level, int blend );
+
+void snes_ntsc_blit_hires_scanlines( snes_ntsc_t const* ntsc, SNES_NTSC_IN_T const* input,
+		long in_row_width, int burst_phase, int in_width, int in_height,
+		void* rgb_out, long out_pitch, double scanline_level, int blend );
+
+/* Same as snes_ntsc_blit() and snes_ntsc_blit_hires(), but while filtering each
+pixel, prefetches the table entries of the pixel distance pixels further along the
+row. Helps with images of many colors, whose entries don't stay in cache, but slows
+images of few colors. Best distance depends on the processor; use benchmark.c to
+find it. A negative distance is treated as 0. Output is identical. */
+void snes_ntsc_blit_prefetch( snes_ntsc_t const* ntsc, SNES_NTSC_IN_T const* input,
+		long in_row_width, int burst_phase, int in_width, int in_height,
+		void* rgb_out, long out_pitch, int distance );
+
+void snes_ntsc_blit_hires_prefetch( snes_ntsc_t const* ntsc, SNES_NTSC_IN_T const* input,
+		long in_row_width, int burst_phase, int in_width, int in_height,
+		void* rgb_out, long out_pitch, int distance );
+
+/* Blitter for input format and output depth chosen at run time rather than in
+snes_ntsc_config.h. Each combination has its own copy of the blitter, so it's as
+fast as the one above. Input pixels are 16 bits and SNES_NTSC_ADJ_IN isn't
+applied. Out_depth can be 14, 15, 16, 24, 32, SNES_NTSC_BGRA8888,
+SNES_NTSC_ARGB8888, or SNES_NTSC_RGB888 (see SNES_NTSC_RGB_OUT below). Returns
+NULL if combination isn't supported. */
+enum { snes_ntsc_in_rgb16 = 0, snes_ntsc_in_bgr15 = 1 };
+typedef void (*snes_ntsc_blit_t)( snes_ntsc_t const* ntsc, unsigned short const* input,
+		long in_row_width, int burst_phase, int in_width, int in_height,
+		void* rgb_out, long out_pitch );
+snes_ntsc_blit_t snes_ntsc_blitter( int in_format, int out_depth, int hires );
+
+/* Thread pool used by the parallel functions. Run() must call task( data, i ) once
+for each i from 0 to task_count - 1, using up to thread_count threads at once (the
+calling one included), and return only after all calls have finished. To share
+your own thread pool, put a snes_ntsc_pool_t at the beginning of your pool
+structure and fill it in. */
+typedef void (*snes_ntsc_task_t)( void* data, int index );
+typedef struct snes_ntsc_pool_t snes_ntsc_pool_t;
+struct snes_ntsc_pool_t
+{
+	int thread_count;
+	void (*run)( snes_ntsc_pool_t*, snes_ntsc_task_t task, void* data, int task_count );
+};
+
+/* Creates built-in pool with thread_count threads, or one per processor if 0.
+Returns NULL if out of memory or threads couldn't be started. Defined in
+snes_ntsc_pool.c, which requires POSIX threads. */
+snes_ntsc_pool_t* snes_ntsc_pool_new( int thread_count );
+void snes_ntsc_pool_delete( snes_ntsc_pool_t* );
+
+/* Same as snes_ntsc_blit(), snes_ntsc_blit_hires() and snes_ntsc_blit_mixed(), but
+split image into bands of rows that are filtered on pool's threads at once. Output
+is identical. Pool can be NULL, in which case the calling thread does all the work. */
+void snes_ntsc_blit_mt( snes_ntsc_t const* ntsc, snes_ntsc_pool_t* pool,
+		SNES_NTSC_IN_T const* input, long in_row_width, int burst_phase,
+		int in_width, int in_height, void* rgb_out, long out_pitch );
+
+void snes_ntsc_blit_hires_mt( snes_ntsc_t const* ntsc, snes_ntsc_pool_t* pool,
+		SNES_NTSC_IN_T const* input, long in_row_width, int burst_phase,
+		int in_width, int in_height, void* rgb_out, long out_pitch );
+
+void snes_ntsc_blit_mixed_mt( snes_ntsc_t const* ntsc, snes_ntsc_pool_t* pool,
+		SNES_NTSC_IN_T const* input, long in_row_width, int burst_phase,
+		int in_width, int in_height, unsigned char const* hires,
+		void* rgb_out, long out_pitch );
+
+/* Same as snes_ntsc_init(), but generates table on pool's threads at once. Table is
+identical. Number of threads used is pool's thread_count; pool can be NULL. */
+void snes_ntsc_init_mt( snes_ntsc_t* ntsc, snes_ntsc_setup_t const* setup,
+		snes_ntsc_pool_t* pool );
+void snes_ntsc_update_mt( snes_ntsc_t* ntsc, snes_ntsc_setup_t const* setup,
+		snes_ntsc_pool_t* pool );
+
+/* Saves initialized table to file, so that later runs can load it rather than
+initialize. Returns NULL on success, otherwise error string. Defined in
+snes_ntsc_file.c. Tables made with bsnes_colortbl can't be saved. */
+char const* snes_ntsc_save( snes_ntsc_t const* ntsc, char const* path );
+
+/* Loads table saved for setup (NULL for snes_ntsc_composite) into ntsc. Fails if
+file was made for different setup, by different library version, or with
+different table configuration. Ntsc can then be used as if just initialized. */
+char const* snes_ntsc_load( snes_ntsc_t* ntsc, char const* path,
+		snes_ntsc_setup_t const* setup );
+
+/* Same as snes_ntsc_load(), but maps file into memory read-only rather than
+copying it, so processes using the same file share one copy. Table can't be
+passed to snes_ntsc_update(). Free with snes_ntsc_unmap(). */
+char const* snes_ntsc_map( snes_ntsc_t const** out, char const* path,
+		snes_ntsc_setup_t const* setup );
+void snes_ntsc_unmap( snes_ntsc_t const* );
+
+/* Attaches read-only to table for setup (NULL for snes_ntsc_composite) in named
+shared memory, first generating it there if no other process has, so processes
+with the same setup share one copy and only the first pays for initialization.
+Free with snes_ntsc_unmap(). Without POSIX shared memory, just allocates and
+initializes a table. */
+char const* snes_ntsc_share( snes_ntsc_t const** out, snes_ntsc_setup_t const* setup );
+
+/* Removes shared table for setup from system, once all processes have freed it */
+void snes_ntsc_unshare( snes_ntsc_setup_t const* setup );
+
+/* Table for preset (snes_ntsc_composite, snes_ntsc_svideo, snes_ntsc_rgb, or
+snes_ntsc_monochrome, or any setup with the same contents; NULL for
+snes_ntsc_composite) generated when program was built, so it needs no
+initialization, or NULL if no table was generated for that setup and precision.
+Read-only like a mapped table. Defined in snes_ntsc_presets.c, which is written by
+presets.c (see Pregenerated Tables in snes_ntsc.txt). */
+snes_ntsc_t const* snes_ntsc_preset( snes_ntsc_setup_t const* setup );
+
+/* Remembers input and burst phase of each row last blitted, so that following
+frames only need to filter rows that changed. Max_width and max_height are the
+largest image that will be blitted, in input pixels, so max_width must be twice
+the low-res width if hires images will be blitted. Returns NULL if out of memory.
+Defined in snes_ntsc_dirty.c. */
+typedef struct snes_ntsc_dirty_t snes_ntsc_dirty_t;
+snes_ntsc_dirty_t* snes_ntsc_dirty_new( int max_width, int max_height );
+void snes_ntsc_dirty_delete( snes_ntsc_dirty_t* );
+
+/* Same as snes_ntsc_blit() and snes_ntsc_blit_hires(), but only filters rows
+whose input or burst phase differ from the previous call, leaving the others in
+rgb_out as they are. Rgb_out must still hold what previous call wrote. If changed
+isn't NULL, it has one byte per row, non-zero for rows that changed, and input
+isn't compared. Returns number of rows skipped, or -1 without blitting anything
+if in_width or in_height is larger than snes_ntsc_dirty_new() was given. All rows
+are filtered when ntsc, in_width, rgb_out, out_pitch, or lores/hires differs from
+previous call, so use a separate snes_ntsc_dirty_t for each buffer when
+double-buffering. */
+int snes_ntsc_blit_dirty( snes_ntsc_dirty_t*, snes_ntsc_t const* ntsc,
+		SNES_NTSC_IN_T const* input, long in_row_width, int burst_phase,
+		int in_width, int in_height, void* rgb_out, long out_pitch,
+		unsigned char const* changed );
+
+int snes_ntsc_blit_hires_dirty( snes_ntsc_dirty_t*, snes_ntsc_t const* ntsc,
+		SNES_NTSC_IN_T const* input, long in_row_width, int burst_phase,
+		int in_width, int in_height, void* rgb_out, long out_pitch,
+		unsigned char const* changed );
+
+/* Makes next call filter all rows. Call after changing ntsc with
+snes_ntsc_update() or modifying rgb_out yourself. */
+void snes_ntsc_dirty_reset( snes_ntsc_dirty_t* );
+
+/* Pair of tables where changed parameters are applied on a background thread, so
+that the thread blitting never waits for initialization and never sees a partly
+generated table. Initializes first table for setup (NULL for snes_ntsc_composite)
+before returning. Pool, if not NULL, is used for generating tables; it shouldn't
+be one blitters use, since a pool runs one job at a time. Returns NULL if out of
+memory or thread couldn't be started. Defined in snes_ntsc_async.c, which requires
+POSIX threads. */
+typedef struct snes_ntsc_async_t snes_ntsc_async_t;
+snes_ntsc_async_t* snes_ntsc_async_new( snes_ntsc_setup_t const* setup,
+		snes_ntsc_pool_t* pool );
+void snes_ntsc_async_delete( snes_ntsc_async_t* );
+
+/* Starts applying setup in the background and returns immediately. Setups passed
+before the previous one was started are skipped, so only the latest is applied. */
+void snes_ntsc_async_update( snes_ntsc_async_t*, snes_ntsc_setup_t const* setup );
+
+/* Table to blit with until next call. Call once per frame before blitting, from
+one thread only. If a newly generated table is complete, it's swapped in and the
+previous one is reused for the next update, so the previous one must no longer
+be in use. Never waits for generation. */
+snes_ntsc_t const* snes_ntsc_async_table( snes_ntsc_async_t* );
+
+/* Non-zero if an update hasn't been swapped in by snes_ntsc_async_table() yet */
+int snes_ntsc_async_pending( snes_ntsc_async_t* );
+
+/* If enable is non-zero, each update is first applied at 10-bit precision, which
+takes a couple of milliseconds, then at the requested precision, unless
+another update arrives first. Keeps the image following a slider while it's being
+dragged. Off by default. */
+void snes_ntsc_async_preview( snes_ntsc_async_t*, int enable );
+
+/* Quality of table last returned by snes_ntsc_async_table() */
+enum { snes_ntsc_quality_preview = 0, snes_ntsc_quality_full = 1 };
+int snes_ntsc_async_quality( snes_ntsc_async_t* );
+
+/* Table for filtering low-res rows to exact aspect ratio, 581 pixels wide for 256
+rather than the 602 of snes_ntsc_blit(), without a separate rescaling pass.
+Generated from setup (NULL for snes_ntsc_composite) on pool's threads; pool can
+be NULL. About five times the size of the normal table (20MB at 13-bit
+precision). Returns NULL if out of memory. Defined in snes_ntsc_exact.c. */
+typedef struct snes_ntsc_exact_t snes_ntsc_exact_t;
+snes_ntsc_exact_t* snes_ntsc_exact_new( snes_ntsc_setup_t const* setup,
+		snes_ntsc_pool_t* pool );
+void snes_ntsc_exact_delete( snes_ntsc_exact_t* );
+
+/* Same as snes_ntsc_blit(), but writes SNES_NTSC_EXACT_OUT_WIDTH( in_width ) pixels
+per row */
+void snes_ntsc_exact_blit( snes_ntsc_exact_t const*, SNES_NTSC_IN_T const* input,
+		long in_row_width, int burst_phase, int in_width, int in_height,
+		void* rgb_out, long out_pitch );
+
+#if SNES_NTSC_PROFILE
+/* Statistics collected by built-in blitters when SNES_NTSC_PROFILE is set in
+snes_ntsc_config.h, summed over all calls on all threads since the last reset.
+Cycles are from the processor's time stamp counter where available, otherwise
+nanoseconds. Hardware counters use perf_event_open() on Linux; has_counters is 0
+if they couldn't be opened (other OS, no permission, or virtual machine without
+them). Defined in snes_ntsc_prof.c. */
+enum { snes_ntsc_prof_buckets = 32 };
+typedef struct snes_ntsc_prof_t
+{
+	unsigned long calls;
+	unsigned long rows;
+	double cycles;
+	int has_counters;
+	double instructions;
+	double llc_misses;  /* last-level cache */
+	double dtlb_misses;
+	
+	/* number of calls whose cycles per row were at least 2^n and less than 2^(n+1) */
+	unsigned long histogram [snes_ntsc_prof_buckets];
+} snes_ntsc_prof_t;
+
+void snes_ntsc_prof_get( snes_ntsc_prof_t* out );
+void snes_ntsc_prof_reset( void );
+#endif
+
 /* Number of output pixels written by low-res blitter for given input width. Width
 might be rounded down slightly; use SNES_NTSC_IN_WIDTH() on result to find rounded
 value. Guaranteed not to round 256 down at all. */
@@ -68,6 +324,19 @@ value. */
 #define SNES_NTSC_IN_WIDTH( out_width ) \
 	(((out_width) / snes_ntsc_out_chunk - 1) * snes_ntsc_in_chunk + 1)
 
+/* Same for snes_ntsc_exact_blit(). Output is in_width * 34 / 15 pixels, rounded
+up, and any input width can be blitted, so SNES_NTSC_EXACT_IN_WIDTH() of
+SNES_NTSC_EXACT_OUT_WIDTH( in_width ) is always in_width. */
+#define SNES_NTSC_EXACT_OUT_WIDTH( in_width ) \
+	(((in_width) * snes_ntsc_exact_out_chunk + snes_ntsc_exact_in_chunk - 1) /\
+			snes_ntsc_exact_in_chunk)
+
+#define SNES_NTSC_EXACT_IN_WIDTH( out_width ) \
+	((out_width) * snes_ntsc_exact_in_chunk / snes_ntsc_exact_out_chunk)
+
+enum { snes_ntsc_exact_in_chunk  = 15 };
+enum { snes_ntsc_exact_out_chunk = 34 };
+
 
 /* Interface for user-defined custom blitters */
 
@@ -80,44 +349,36 @@ enum { snes_ntsc_burst_count = 3  }; /* burst phase cycles through 0, 1, and 2 *
 Use snes_ntsc_black for unused pixels. Declares variables, so must be before first
 statement in a block (unless you're using C++). */
 #define SNES_NTSC_BEGIN_ROW( ntsc, burst, pixel0, pixel1, pixel2 ) \
-	char const* ktable = \
-		(char const*) (ntsc)->table + burst * (snes_ntsc_burst_size * sizeof (snes_ntsc_rgb_t));\
+	SNES_NTSC_ROW_( ntsc, burst )\
 	SNES_NTSC_BEGIN_ROW_6_( pixel0, pixel1, pixel2, SNES_NTSC_IN_FORMAT, ktable )
 
 /* Begins input pixel */
 #define SNES_NTSC_COLOR_IN( index, color ) \
 	SNES_NTSC_COLOR_IN_( index, color, SNES_NTSC_IN_FORMAT, ktable )
 
-/* Generates output pixel. Bits can be 24, 16, 15, 14, 32 (treated as 24), or 0:
+/* Generates output pixel. Bits can be 24, 16, 15, 14, 32 (treated as 24), 0, or
+one of the byte order formats below:
 24:          RRRRRRRR GGGGGGGG BBBBBBBB (8-8-8 RGB)
 16:                   RRRRRGGG GGGBBBBB (5-6-5 RGB)
 15:                    RRRRRGG GGGBBBBB (5-5-5 RGB)
 14:                    BBBBBGG GGGRRRRR (5-5-5 BGR, native SNES format)
- 0: xxxRRRRR RRRxxGGG GGGGGxxB BBBBBBBx (native internal format; x = junk bits) */
+ 0: xxxRRRRR RRRxxGGG GGGGGxxB BBBBBBBx (native internal format; x = junk bits)
+BGRA8888: 11111111 RRRRRRRR GGGGGGGG BBBBBBBB (bytes B, G, R, A on little-endian)
+ARGB8888: BBBBBBBB GGGGGGGG RRRRRRRR 11111111 (bytes A, R, G, B on little-endian)
+RGB888:   bytes R, G, B in that order. Rgb_out is the first of the three
+          unsigned char, so the next pixel's is three bytes later. */
 #define SNES_NTSC_RGB_OUT( index, rgb_out, bits ) \
 	SNES_NTSC_RGB_OUT_14_( index, rgb_out, bits, 1 )
 
+/* Values of bits for byte order formats. Alpha is always opaque. */
+#define SNES_NTSC_BGRA8888 0x8888
+#define SNES_NTSC_ARGB8888 0x8889
+#define SNES_NTSC_RGB888    0x888
+
 /* Hires equivalents */
 #define SNES_NTSC_HIRES_ROW( ntsc, burst, pixel1, pixel2, pixel3, pixel4, pixel5 ) \
-	char const* ktable = \
-		(char const*) (ntsc)->table + burst * (snes_ntsc_burst_size * sizeof (snes_ntsc_rgb_t));\
-	unsigned const snes_ntsc_pixel1_ = (pixel1);\
-	snes_ntsc_rgb_t const* kernel1  = SNES_NTSC_IN_FORMAT( ktable, snes_ntsc_pixel1_ );\
-	unsigned const snes_ntsc_pixel2_ = (pixel2);\
-	snes_ntsc_rgb_t const* kernel2  = SNES_NTSC_IN_FORMAT( ktable, snes_ntsc_pixel2_ );\
-	unsigned const snes_ntsc_pixel3_ = (pixel3);\
-	snes_ntsc_rgb_t const* kernel3  = SNES_NTSC_IN_FORMAT( ktable, snes_ntsc_pixel3_ );\
-	unsigned const snes_ntsc_pixel4_ = (pixel4);\
-	snes_ntsc_rgb_t const* kernel4  = SNES_NTSC_IN_FORMAT( ktable, snes_ntsc_pixel4_ );\
-	unsigned const snes_ntsc_pixel5_ = (pixel5);\
-	snes_ntsc_rgb_t const* kernel5  = SNES_NTSC_IN_FORMAT( ktable, snes_ntsc_pixel5_ );\
-	snes_ntsc_rgb_t const* kernel0 = kernel1;\
-	snes_ntsc_rgb_t const* kernelx0;\
-	snes_ntsc_rgb_t const* kernelx1 = kernel1;\
-	snes_ntsc_rgb_t const* kernelx2 = kernel1;\
-	snes_ntsc_rgb_t const* kernelx3 = kernel1;\
-	snes_ntsc_rgb_t const* kernelx4 = kernel1;\
-	snes_ntsc_rgb_t const* kernelx5 = kernel1
+	SNES_NTSC_ROW_( ntsc, burst )\
+	SNES_NTSC_HIRES_ROW_( pixel1, pixel2, pixel3, pixel4, pixel5, SNES_NTSC_IN_FORMAT, ktable )
 
 #define SNES_NTSC_HIRES_OUT( x, rgb_out, bits ) {\
 	snes_ntsc_rgb_t raw_ =\
@@ -132,32 +393,240 @@ statement in a block (unless you're using C++). */
 
 /* private */
 enum { snes_ntsc_entry_size = 128 };
-enum { snes_ntsc_palette_size = 0x2000 };
-typedef unsigned long snes_ntsc_rgb_t;
+enum { snes_ntsc_palette_size = 1 << SNES_NTSC_MAX_PRECISION }; /* entries at highest precision */
+#if UINT_MAX == 0xFFFFFFFF
+	typedef unsigned int  snes_ntsc_rgb_t;
+#elif ULONG_MAX == 0xFFFFFFFF
+	typedef unsigned long snes_ntsc_rgb_t;
+#else
+	#error "Need 32-bit int type"
+#endif
+enum { snes_ntsc_impl_size = 900 }; /* floats of saved init state */
+typedef struct snes_ntsc_saved_t
+{
+	snes_ntsc_setup_t setup; /* setup of last init; decoder_matrix points to decoder */
+	float decoder [6];
+	int merge_fields;
+	int precision;     /* 10, 12, 13, or 15 */
+	int both_fields;   /* 1 if merged entries follow unmerged ones */
+	float impl [snes_ntsc_impl_size];
+} snes_ntsc_saved_t;
+
+/* Byte offset of table entry for input color is made of red, green, and blue
+fields, each taken from color by shifting then masking */
+typedef struct snes_ntsc_index_t
+{
+	snes_ntsc_rgb_t mask [3];
+	unsigned char rgb16 [3]; /* left shifts */
+	unsigned char bgr15 [3]; /* left, left, right */
+	long variant; /* bytes to entries for current merge_fields setting */
+	#if SNES_NTSC_ALIGNED
+		long group; /* bytes from one alignment's table to the next */
+	#endif
+} snes_ntsc_index_t;
+
+enum { snes_ntsc_burst_size = snes_ntsc_entry_size / snes_ntsc_burst_count };
+
+#if SNES_NTSC_ALIGNED
+	/* For each burst phase, three tables, one for each of the three input pixel
+	alignments in a chunk. Each has the 14 values of an entry that one alignment
+	reads, padded to a 64-byte cache line, so that each input pixel reads exactly
+	one line. Values of alignment n are at 14*n to 14*n+13 of a kernel pointer, as
+	in normal table, so kernel for alignment n points 14*n values before its line. */
+	enum { snes_ntsc_line_size = 16 };
+	enum { snes_ntsc_group_size = snes_ntsc_burst_size / 3 };
+	enum { snes_ntsc_table_size = snes_ntsc_burst_count * 3 * snes_ntsc_palette_size *
+			snes_ntsc_line_size };
+	
+	/* first line, since struct might not be aligned */
+	#define SNES_NTSC_TABLE_( ntsc ) \
+		((char const*) (ntsc)->table + (-(size_t) (ntsc)->table & 63))
+	
+	#define SNES_NTSC_BURST_( burst ) (burst * 3 * snes_ntsc_index_.group)
+	
+	/* table for kernels of alignment n */
+	#define SNES_NTSC_GROUP_( table, n ) \
+		(table + (n) * (snes_ntsc_index_.group -\
+				snes_ntsc_group_size * (long) sizeof (snes_ntsc_rgb_t)))
+#else
+	enum { snes_ntsc_table_size = snes_ntsc_palette_size * snes_ntsc_entry_size };
+	#define SNES_NTSC_TABLE_( ntsc ) ((char const*) (ntsc)->table)
+	#define SNES_NTSC_BURST_( burst ) \
+		(burst * (snes_ntsc_burst_size * sizeof (snes_ntsc_rgb_t)))
+#endif
+
 struct snes_ntsc_t {
-	snes_ntsc_rgb_t table [snes_ntsc_palette_size] [snes_ntsc_entry_size];
+	snes_ntsc_index_t index;
+	snes_ntsc_saved_t saved;
+	#if SNES_NTSC_LAZY
+		unsigned char built [snes_ntsc_palette_size]; /* snes_ntsc_entry_* */
+	#endif
+	/* last, so that only the entries in use need to be in memory */
+	#if SNES_NTSC_ALIGNED
+		/* extra for alignment, and for SIMD loads past end of last line */
+		snes_ntsc_rgb_t table [snes_ntsc_table_size + snes_ntsc_line_size * 2];
+	#else
+		snes_ntsc_rgb_t table [snes_ntsc_palette_size] [snes_ntsc_entry_size];
+	#endif
 };
-enum { snes_ntsc_burst_size = snes_ntsc_entry_size / snes_ntsc_burst_count };
 
-#define SNES_NTSC_RGB16( ktable, n ) \
-	(snes_ntsc_rgb_t const*) (ktable + ((n & 0x001E) | (n >> 1 & 0x03E0) | (n >> 2 & 0x3C00)) * \
-			(snes_ntsc_entry_size / 2 * sizeof (snes_ntsc_rgb_t)))
+/* Table files and pregenerated tables store a snes_ntsc_t as it is in memory, 64-byte
+aligned, up to the end of the entries in use */
+#if SNES_NTSC_ALIGNED
+	/* values stored for each entry, over all its tables */
+	enum { snes_ntsc_stored_entry_size = snes_ntsc_burst_count * 3 * snes_ntsc_line_size };
+	
+	/* bytes between table member and first line */
+	#define SNES_NTSC_TABLE_PAD_ ((0 - offsetof (snes_ntsc_t, table)) & 63)
+#else
+	enum { snes_ntsc_stored_entry_size = snes_ntsc_entry_size };
+	#define SNES_NTSC_TABLE_PAD_ 0
+#endif
+
+/* bytes of entries in use; table with both_fields has twice as many */
+#define SNES_NTSC_STORED_TABLE_( precision, both_fields ) \
+	(((size_t) snes_ntsc_stored_entry_size * sizeof (snes_ntsc_rgb_t)) << ((precision) + (both_fields)))
+
+/* bytes of snes_ntsc_t stored */
+#define SNES_NTSC_STORED_SIZE_( precision, both_fields ) \
+	(offsetof (snes_ntsc_t, table) + SNES_NTSC_TABLE_PAD_ +\
+			SNES_NTSC_STORED_TABLE_( precision, both_fields ))
+
+/* Merge_fields, precision, and both_fields that snes_ntsc_init() uses for setup,
+after defaults and limits are applied */
+int snes_ntsc_merge_fields_( snes_ntsc_setup_t const* setup );
+int snes_ntsc_precision_( snes_ntsc_setup_t const* setup );
+int snes_ntsc_both_fields_( snes_ntsc_setup_t const* setup );
+
+/* True if snes_ntsc_init() with setup would generate the same table as ntsc has */
+int snes_ntsc_same_setup_( snes_ntsc_t const* ntsc, snes_ntsc_setup_t const* setup );
+
+/* Redoes one signal processing stage of initialization for setup, without
+generating table: 0 artifacts, 1 levels, 2 filters, 3 decoder. Used by
+snes_ntsc_update() and to time stages in benchmark.c. */
+void snes_ntsc_init_stage_( snes_ntsc_t* ntsc, snes_ntsc_setup_t const* setup, int stage );
+
+/* n is offset of entry in bytes */
+#define SNES_NTSC_ENTRY_( ktable, n ) (SNES_NTSC_LAZY_BUILD_( n )\
+	(snes_ntsc_rgb_t const*) (ktable + (n)))
+
+/* Pixels in different alignments use different tables when SNES_NTSC_ALIGNED is
+set; otherwise they share table and these add nothing */
+#if SNES_NTSC_ALIGNED
+	#define SNES_NTSC_TABLES_3_( table ) \
+		char const* const table##0 = table;\
+		char const* const table##1 = SNES_NTSC_GROUP_( table, 1 );\
+		char const* const table##2 = SNES_NTSC_GROUP_( table, 2 );
+	
+	/* hires pixels are half as wide, so two in each alignment */
+	#define SNES_NTSC_TABLES_6_( table ) \
+		char const* const table##0 = table;\
+		char const* const table##1 = table;\
+		char const* const table##2 = SNES_NTSC_GROUP_( table, 1 );\
+		char const* const table##3 = table##2;\
+		char const* const table##4 = SNES_NTSC_GROUP_( table, 2 );\
+		char const* const table##5 = table##4;
+	#define SNES_NTSC_TABLE_N_( table, n ) table##n
+	
+	/* kernel for same color in another alignment's table */
+	#define SNES_NTSC_SAME_( ENTRY, table, n, pixel, kernel ) ENTRY( table##n, pixel )
+#else
+	#define SNES_NTSC_TABLES_3_( table )
+	#define SNES_NTSC_TABLES_6_( table )
+	#define SNES_NTSC_TABLE_N_( table, n ) table
+	#define SNES_NTSC_SAME_( ENTRY, table, n, pixel, kernel ) kernel
+#endif
+
+#define SNES_NTSC_RGB16( ktable, n ) SNES_NTSC_ENTRY_( ktable,\
+	((snes_ntsc_rgb_t) (n) << snes_ntsc_index_.rgb16 [0] & snes_ntsc_index_.mask [0]) |\
+	((snes_ntsc_rgb_t) (n) << snes_ntsc_index_.rgb16 [1] & snes_ntsc_index_.mask [1]) |\
+	((snes_ntsc_rgb_t) (n) << snes_ntsc_index_.rgb16 [2] & snes_ntsc_index_.mask [2]) )
+
+#define SNES_NTSC_BGR15( ktable, n ) SNES_NTSC_ENTRY_( ktable,\
+	((snes_ntsc_rgb_t) (n) << snes_ntsc_index_.bgr15 [0] & snes_ntsc_index_.mask [0]) |\
+	((snes_ntsc_rgb_t) (n) << snes_ntsc_index_.bgr15 [1] & snes_ntsc_index_.mask [1]) |\
+	((snes_ntsc_rgb_t) (n) >> snes_ntsc_index_.bgr15 [2] & snes_ntsc_index_.mask [2]) )
+
+/* Index depends on precision, so a copy is kept where compiler can hold it in registers */
+#define SNES_NTSC_INDEX_ROW_( ntsc ) \
+	snes_ntsc_index_t const snes_ntsc_index_ = (ntsc)->index;
+
+/* Lazy table: entries are generated the first time a blitter uses them */
+#if SNES_NTSC_LAZY
+	enum { snes_ntsc_entry_empty = 0, snes_ntsc_entry_building = 1, snes_ntsc_entry_built = 2 };
+	#if SNES_NTSC_ALIGNED
+		enum { snes_ntsc_entry_bytes_ = snes_ntsc_line_size * sizeof (snes_ntsc_rgb_t) };
+	#else
+		enum { snes_ntsc_entry_bytes_ = snes_ntsc_entry_size * sizeof (snes_ntsc_rgb_t) };
+	#endif
+	
+	/* Generates entry if no other thread has, otherwise waits for it. Returns 1. */
+	int snes_ntsc_build_entry_( snes_ntsc_t const*, int entry );
+	
+	#if defined (__GNUC__)
+		#define SNES_NTSC_LOAD_ACQUIRE_( p ) __atomic_load_n( p, __ATOMIC_ACQUIRE )
+	#else
+		/* volatile reads have acquire semantics with MSVC */
+		#define SNES_NTSC_LOAD_ACQUIRE_( p ) (*(unsigned char const volatile*) (p))
+	#endif
+	
+	#define SNES_NTSC_LAZY_ROW_( ntsc ) \
+		snes_ntsc_t const* const snes_ntsc_lazy_ = (ntsc);
+	
+	#define SNES_NTSC_LAZY_BUILD_( n ) \
+		(void) (SNES_NTSC_LOAD_ACQUIRE_( &snes_ntsc_lazy_->built [(n) / snes_ntsc_entry_bytes_] ) ==\
+				snes_ntsc_entry_built ||\
+				snes_ntsc_build_entry_( snes_ntsc_lazy_, (int) ((n) / snes_ntsc_entry_bytes_) )),
+#else
+	#define SNES_NTSC_LAZY_ROW_( ntsc )
+	#define SNES_NTSC_LAZY_BUILD_( n )
+#endif
+
+/* Profiling hooks around each blitter call */
+#if SNES_NTSC_PROFILE
+	void snes_ntsc_prof_begin_( void );
+	void snes_ntsc_prof_end_( int rows );
+#endif
+
+/* Declares per-row variables used by the other macros */
+#define SNES_NTSC_ROW_( ntsc, burst ) \
+	SNES_NTSC_INDEX_ROW_( ntsc )\
+	SNES_NTSC_LAZY_ROW_( ntsc )\
+	char const* ktable = SNES_NTSC_TABLE_( ntsc ) + snes_ntsc_index_.variant +\
+			SNES_NTSC_BURST_( burst );
 
-#define SNES_NTSC_BGR15( ktable, n ) \
-	(snes_ntsc_rgb_t const*) (ktable + ((n << 9 & 0x3C00) | (n & 0x03E0) | (n >> 10 & 0x001E)) * \
-			(snes_ntsc_entry_size / 2 * sizeof (snes_ntsc_rgb_t)))
+#define SNES_NTSC_HIRES_ROW_( pixel1, pixel2, pixel3, pixel4, pixel5, ENTRY, table ) \
+	SNES_NTSC_TABLES_6_( table )\
+	unsigned const snes_ntsc_pixel1_ = (pixel1);\
+	snes_ntsc_rgb_t const* kernel1  = ENTRY( SNES_NTSC_TABLE_N_( table, 1 ), snes_ntsc_pixel1_ );\
+	unsigned const snes_ntsc_pixel2_ = (pixel2);\
+	snes_ntsc_rgb_t const* kernel2  = ENTRY( SNES_NTSC_TABLE_N_( table, 2 ), snes_ntsc_pixel2_ );\
+	unsigned const snes_ntsc_pixel3_ = (pixel3);\
+	snes_ntsc_rgb_t const* kernel3  = ENTRY( SNES_NTSC_TABLE_N_( table, 3 ), snes_ntsc_pixel3_ );\
+	unsigned const snes_ntsc_pixel4_ = (pixel4);\
+	snes_ntsc_rgb_t const* kernel4  = ENTRY( SNES_NTSC_TABLE_N_( table, 4 ), snes_ntsc_pixel4_ );\
+	unsigned const snes_ntsc_pixel5_ = (pixel5);\
+	snes_ntsc_rgb_t const* kernel5  = ENTRY( SNES_NTSC_TABLE_N_( table, 5 ), snes_ntsc_pixel5_ );\
+	snes_ntsc_rgb_t const* kernel0 = kernel1;\
+	snes_ntsc_rgb_t const* kernelx0;\
+	snes_ntsc_rgb_t const* kernelx1 = kernel1;\
+	snes_ntsc_rgb_t const* kernelx2 = SNES_NTSC_SAME_( ENTRY, table, 2, snes_ntsc_pixel1_, kernel1 );\
+	snes_ntsc_rgb_t const* kernelx3 = kernelx2;\
+	snes_ntsc_rgb_t const* kernelx4 = SNES_NTSC_SAME_( ENTRY, table, 4, snes_ntsc_pixel1_, kernel1 );\
+	snes_ntsc_rgb_t const* kernelx5 = kernelx4
 
 /* common 3->7 ntsc macros */
 #define SNES_NTSC_BEGIN_ROW_6_( pixel0, pixel1, pixel2, ENTRY, table ) \
+	SNES_NTSC_TABLES_3_( table )\
 	unsigned const snes_ntsc_pixel0_ = (pixel0);\
-	snes_ntsc_rgb_t const* kernel0  = ENTRY( table, snes_ntsc_pixel0_ );\
+	snes_ntsc_rgb_t const* kernel0  = ENTRY( SNES_NTSC_TABLE_N_( table, 0 ), snes_ntsc_pixel0_ );\
 	unsigned const snes_ntsc_pixel1_ = (pixel1);\
-	snes_ntsc_rgb_t const* kernel1  = ENTRY( table, snes_ntsc_pixel1_ );\
+	snes_ntsc_rgb_t const* kernel1  = ENTRY( SNES_NTSC_TABLE_N_( table, 1 ), snes_ntsc_pixel1_ );\
 	unsigned const snes_ntsc_pixel2_ = (pixel2);\
-	snes_ntsc_rgb_t const* kernel2  = ENTRY( table, snes_ntsc_pixel2_ );\
+	snes_ntsc_rgb_t const* kernel2  = ENTRY( SNES_NTSC_TABLE_N_( table, 2 ), snes_ntsc_pixel2_ );\
 	snes_ntsc_rgb_t const* kernelx0;\
-	snes_ntsc_rgb_t const* kernelx1 = kernel0;\
-	snes_ntsc_rgb_t const* kernelx2 = kernel0
+	snes_ntsc_rgb_t const* kernelx1 = SNES_NTSC_SAME_( ENTRY, table, 1, snes_ntsc_pixel0_, kernel0 );\
+	snes_ntsc_rgb_t const* kernelx2 = SNES_NTSC_SAME_( ENTRY, table, 2, snes_ntsc_pixel0_, kernel0 )
 
 #define SNES_NTSC_RGB_OUT_14_( x, rgb_out, bits, shift ) {\
 	snes_ntsc_rgb_t raw_ =\
@@ -179,10 +648,38 @@ enum { snes_ntsc_burst_size = snes_ntsc_entry_size / snes_ntsc_burst_count };
 	io &= clamp;\
 }
 
+/* Prefetches the part of a table entry that a burst phase uses */
+#if defined (__GNUC__)
+	#define SNES_NTSC_PREFETCH_( p ) __builtin_prefetch( p )
+#elif defined (_MSC_VER) && (defined (_M_IX86) || defined (_M_X64))
+	#include <xmmintrin.h>
+	#define SNES_NTSC_PREFETCH_( p ) _mm_prefetch( (char const*) (p), _MM_HINT_T0 )
+#else
+	#define SNES_NTSC_PREFETCH_( p ) (void) (p)
+#endif
+
+#if SNES_NTSC_ALIGNED
+	/* line in each alignment's table, since pixel's alignment isn't known */
+	#define SNES_NTSC_PREFETCH_IN_( color, ENTRY, table ) {\
+		unsigned const pcolor_ = (color);\
+		SNES_NTSC_PREFETCH_( ENTRY( table, pcolor_ ) );\
+		SNES_NTSC_PREFETCH_( ENTRY( SNES_NTSC_GROUP_( table, 1 ), pcolor_ ) + snes_ntsc_group_size );\
+		SNES_NTSC_PREFETCH_( ENTRY( SNES_NTSC_GROUP_( table, 2 ), pcolor_ ) + snes_ntsc_group_size * 2 );\
+	}
+#else
+	#define SNES_NTSC_PREFETCH_IN_( color, ENTRY, table ) {\
+		char const* entry_ = (char const*) ENTRY( table, color );\
+		SNES_NTSC_PREFETCH_( entry_ );\
+		SNES_NTSC_PREFETCH_( entry_ + 64 );\
+		SNES_NTSC_PREFETCH_( entry_ + 128 );\
+		SNES_NTSC_PREFETCH_( entry_ + snes_ntsc_burst_size * sizeof (snes_ntsc_rgb_t) - 1 );\
+	}
+#endif
+
 #define SNES_NTSC_COLOR_IN_( index, color, ENTRY, table ) {\
 	unsigned color_;\
 	kernelx##index = kernel##index;\
-	kernel##index = (color_ = (color), ENTRY( table, color_ ));\
+	kernel##index = (color_ = (color), ENTRY( SNES_NTSC_TABLE_N_( table, index ), color_ ));\
 }
 
 /* x is always zero except in snes_ntsc library */
@@ -197,6 +694,16 @@ enum { snes_ntsc_burst_size = snes_ntsc_entry_size / snes_ntsc_burst_count };
 		rgb_out = (raw_>>(24-x)& 0x001F)|(raw_>>(9-x)&0x03E0)|(raw_<<(6+x)&0x7C00);\
 	if ( bits == 0 )\
 		rgb_out = raw_ << x;\
+	if ( bits == SNES_NTSC_BGRA8888 )\
+		rgb_out = (raw_>>(5-x)&0xFF0000)|(raw_>>(3-x)&0xFF00)|(raw_>>(1-x)&0xFF)|0xFF000000;\
+	if ( bits == SNES_NTSC_ARGB8888 )\
+		rgb_out = (raw_<<(23+x)&0xFF000000)|(raw_<<(5+x)&0xFF0000)|(raw_>>(13-x)&0xFF00)|0xFF;\
+	if ( bits == SNES_NTSC_RGB888 )\
+	{\
+		(&(rgb_out)) [0] = (unsigned char) (raw_>>(21-x));\
+		(&(rgb_out)) [1] = (unsigned char) (raw_>>(11-x));\
+		(&(rgb_out)) [2] = (unsigned char) (raw_>>( 1-x));\
+	}\
 }
 
 #ifdef __cplusplus
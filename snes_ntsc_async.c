@@ -0,0 +1,245 @@
+/* snes_ntsc 0.2.2. http://www.slack.net/~ant/ */
+
+/* Table regenerated on a background thread. Uses POSIX threads. */
+
+#include "snes_ntsc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Copyright (C) 2006-2007 Shay Green. This module is free software; you
+can redistribute it and/or modify it under the terms of the GNU Lesser
+General Public License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version. This
+module is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+details. You should have received a copy of the GNU Lesser General Public
+License along with this module; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
+
+struct snes_ntsc_async_t
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t wake;
+	pthread_t thread;
+	snes_ntsc_pool_t* pool;
+	int back_inited; /* only used by background thread */
+	int quality;     /* of front; only used by thread calling snes_ntsc_async_table() */
+	
+	/* protected by mutex */
+	snes_ntsc_t* front; /* table being blitted with */
+	snes_ntsc_t* back;  /* table being generated */
+	snes_ntsc_setup_t setup; /* latest requested; decoder_matrix points to decoder */
+	float decoder [6];
+	int requested; /* setup hasn't been generated yet */
+	int refine;    /* setup has only been generated as preview */
+	int preview;   /* generate preview of each setup first */
+	int building;  /* back is being generated */
+	int ready;     /* back is complete and newer than front */
+	int back_quality;
+	int quit;
+};
+
+enum { preview_precision = 10 };
+
+#if SNES_NTSC_LAZY
+	/* Entries would otherwise be generated by blitters, stalling the frame loop, so
+	they're all generated here before the table is swapped in */
+	typedef struct build_band_t
+	{
+		snes_ntsc_t const* ntsc;
+		int entry_count;
+		int band_size;
+	} build_band_t;
+	
+	static void build_band( void* data, int index )
+	{
+		build_band_t const* b = (build_band_t const*) data;
+		int entry = index * b->band_size;
+		int end = entry + b->band_size;
+		if ( end > b->entry_count )
+			end = b->entry_count;
+		for ( ; entry < end; entry++ )
+			snes_ntsc_build_entry_( b->ntsc, entry );
+	}
+	
+	static void build_all( snes_ntsc_t const* ntsc, snes_ntsc_pool_t* pool )
+	{
+		int band_count = (pool ? pool->thread_count : 1);
+		build_band_t b;
+		b.ntsc        = ntsc;
+		b.entry_count = 1 << ntsc->saved.precision;
+		b.band_size   = (b.entry_count + band_count - 1) / band_count;
+		if ( band_count > 1 )
+			pool->run( pool, build_band, &b, band_count );
+		else
+			build_band( &b, 0 );
+	}
+#else
+	#define build_all( ntsc, pool ) ((void) 0)
+#endif
+
+static void* builder( void* arg )
+{
+	snes_ntsc_async_t* a = (snes_ntsc_async_t*) arg;
+	pthread_mutex_lock( &a->mutex );
+	for ( ;; )
+	{
+		snes_ntsc_setup_t setup;
+		float decoder [6];
+		
+		/* a complete table waits to be swapped in rather than be overwritten, so
+		that continuous updates still reach the screen */
+		while ( (!(a->requested || a->refine) || a->ready) && !a->quit )
+			pthread_cond_wait( &a->wake, &a->mutex );
+		if ( a->quit )
+			break;
+		
+		/* caller can request another setup while this one is generated */
+		setup = a->setup;
+		if ( setup.decoder_matrix )
+		{
+			memcpy( decoder, a->decoder, sizeof decoder );
+			setup.decoder_matrix = decoder;
+		}
+		
+		/* full table follows preview once nothing newer has been requested */
+		a->back_quality = snes_ntsc_quality_full;
+		a->refine = 0;
+		if ( a->requested && a->preview )
+		{
+			setup.precision = preview_precision;
+			a->back_quality = snes_ntsc_quality_preview;
+			a->refine = 1;
+		}
+		a->requested = 0;
+		a->building  = 1;
+		pthread_mutex_unlock( &a->mutex );
+		
+		/* back was front before last swap, so it only needs the changed stages redone */
+		if ( a->back_inited )
+			snes_ntsc_update_mt( a->back, &setup, a->pool );
+		else
+			snes_ntsc_init_mt( a->back, &setup, a->pool );
+		build_all( a->back, a->pool );
+		a->back_inited = 1;
+		
+		pthread_mutex_lock( &a->mutex );
+		a->building = 0;
+		a->ready    = 1;
+	}
+	pthread_mutex_unlock( &a->mutex );
+	return 0;
+}
+
+snes_ntsc_async_t* snes_ntsc_async_new( snes_ntsc_setup_t const* setup,
+		snes_ntsc_pool_t* pool )
+{
+	snes_ntsc_async_t* a = (snes_ntsc_async_t*) calloc( 1, sizeof *a );
+	if ( !a )
+		return 0;
+	
+	a->pool    = pool;
+	a->quality = snes_ntsc_quality_full;
+	a->front   = (snes_ntsc_t*) malloc( sizeof *a->front );
+	a->back    = (snes_ntsc_t*) malloc( sizeof *a->back ); /* generated when first needed */
+	if ( a->front && a->back )
+	{
+		snes_ntsc_init_mt( a->front, setup, pool );
+		build_all( a->front, pool );
+		pthread_mutex_init( &a->mutex, 0 );
+		pthread_cond_init( &a->wake, 0 );
+		if ( !pthread_create( &a->thread, 0, builder, a ) )
+			return a;
+		
+		pthread_cond_destroy( &a->wake );
+		pthread_mutex_destroy( &a->mutex );
+	}
+	
+	free( a->front );
+	free( a->back );
+	free( a );
+	return 0;
+}
+
+void snes_ntsc_async_delete( snes_ntsc_async_t* a )
+{
+	if ( a )
+	{
+		pthread_mutex_lock( &a->mutex );
+		a->quit = 1;
+		pthread_cond_signal( &a->wake );
+		pthread_mutex_unlock( &a->mutex );
+		
+		pthread_join( a->thread, 0 );
+		pthread_cond_destroy( &a->wake );
+		pthread_mutex_destroy( &a->mutex );
+		free( a->front );
+		free( a->back );
+		free( a );
+	}
+}
+
+void snes_ntsc_async_update( snes_ntsc_async_t* a, snes_ntsc_setup_t const* setup )
+{
+	if ( !setup )
+		setup = &snes_ntsc_composite;
+	
+	pthread_mutex_lock( &a->mutex );
+	
+	/* replaces any setup not yet started */
+	a->setup = *setup;
+	if ( setup->decoder_matrix )
+	{
+		memcpy( a->decoder, setup->decoder_matrix, sizeof a->decoder );
+		a->setup.decoder_matrix = a->decoder;
+	}
+	a->requested = 1;
+	pthread_cond_signal( &a->wake );
+	pthread_mutex_unlock( &a->mutex );
+}
+
+snes_ntsc_t const* snes_ntsc_async_table( snes_ntsc_async_t* a )
+{
+	/* mutex is only held briefly, but keep current table rather than wait */
+	if ( !pthread_mutex_trylock( &a->mutex ) )
+	{
+		if ( a->ready )
+		{
+			snes_ntsc_t* t = a->front;
+			a->front   = a->back;
+			a->back    = t;
+			a->ready   = 0;
+			a->quality = a->back_quality;
+			
+			/* old front is free now, so next requested setup can be generated */
+			if ( a->requested || a->refine )
+				pthread_cond_signal( &a->wake );
+		}
+		pthread_mutex_unlock( &a->mutex );
+	}
+	return a->front;
+}
+
+int snes_ntsc_async_pending( snes_ntsc_async_t* a )
+{
+	int pending;
+	pthread_mutex_lock( &a->mutex );
+	pending = a->requested || a->refine || a->building || a->ready;
+	pthread_mutex_unlock( &a->mutex );
+	return pending;
+}
+
+void snes_ntsc_async_preview( snes_ntsc_async_t* a, int enable )
+{
+	pthread_mutex_lock( &a->mutex );
+	a->preview = enable;
+	pthread_mutex_unlock( &a->mutex );
+}
+
+int snes_ntsc_async_quality( snes_ntsc_async_t* a )
+{
+	return a->quality;
+}
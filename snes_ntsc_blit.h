@@ -0,0 +1,418 @@
+/* snes_ntsc 0.2.2. http://www.slack.net/~ant/ */
+
+/* Blitter template. Included by snes_ntsc.c once for each combination of
+formats, after defining the following:
+
+BLIT_NAME, BLIT_HIRES_NAME  names of low-res and hires blitter functions
+BLIT_LINKAGE                empty or static
+BLIT_IN_T                   type of input pixel
+BLIT_ADJ_IN( in )           adjusts input pixel value, as SNES_NTSC_ADJ_IN
+BLIT_IN_FORMAT              SNES_NTSC_RGB16 or SNES_NTSC_BGR15
+BLIT_OUT_DEPTH              output depth, as SNES_NTSC_OUT_DEPTH
+BLIT_SCANLINES              1 to write scanline row after each output row (optional)
+BLIT_PREFETCH               1 to take distance parameter and prefetch table entries
+                            for pixels that far ahead (optional)
+
+The names, input format, output depth, BLIT_SCANLINES and BLIT_PREFETCH are
+undefined at the end. */
+
+/* Copyright (C) 2006-2007 Shay Green. This module is free software; you
+can redistribute it and/or modify it under the terms of the GNU Lesser
+General Public License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version. This
+module is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+details. You should have received a copy of the GNU Lesser General Public
+License along with this module; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
+
+/* RGB888 writes each pixel as three bytes, the rest as one value */
+#if BLIT_OUT_DEPTH == SNES_NTSC_RGB888
+	#define BLIT_OUT_T unsigned char
+	#define BLIT_OUT_SIZE_ 3
+#elif BLIT_OUT_DEPTH <= 16
+	#define BLIT_OUT_T snes_ntsc_out16_t
+	#define BLIT_OUT_SIZE_ 1
+#else
+	#define BLIT_OUT_T snes_ntsc_out32_t
+	#define BLIT_OUT_SIZE_ 1
+#endif
+
+#define PIXEL_OUT( n ) line_out [(n) * BLIT_OUT_SIZE_]
+
+#define COLOR_IN( index, color ) \
+	SNES_NTSC_COLOR_IN_( index, color, BLIT_IN_FORMAT, ktable )
+
+#ifndef BLIT_SCANLINES
+	#define BLIT_SCANLINES 0
+#endif
+
+#ifndef BLIT_PREFETCH
+	#define BLIT_PREFETCH 0
+#endif
+
+#if BLIT_PREFETCH
+	#if BLIT_SCANLINES
+		#error "BLIT_PREFETCH can't be combined with BLIT_SCANLINES"
+	#endif
+	#define BLIT_PREFETCH_IN_( pixel ) \
+		SNES_NTSC_PREFETCH_IN_( BLIT_ADJ_IN( pixel ), BLIT_IN_FORMAT, ktable )
+#endif
+
+#if BLIT_SCANLINES
+	/* masks of red and blue, green, and lowest bit of each. Blue times dark
+	mustn't reach red, so level has fewer bits for 16-bit output. */
+	#if BLIT_OUT_DEPTH == 16
+		#define BLIT_RB_    0xF81F
+		#define BLIT_G_     0x07E0
+		#define BLIT_LOW_   0x0821
+		#define BLIT_LEVEL_BITS_ 5
+	#elif BLIT_OUT_DEPTH <= 15
+		#define BLIT_RB_    0x7C1F
+		#define BLIT_G_     0x03E0
+		#define BLIT_LOW_   0x0421
+		#define BLIT_LEVEL_BITS_ 5
+	#elif BLIT_OUT_DEPTH == SNES_NTSC_RGB888
+		#define BLIT_RB_    0xFF
+		#define BLIT_G_     0x00
+		#define BLIT_LOW_   0x01
+		#define BLIT_LEVEL_BITS_ 8
+	#else
+		#define BLIT_RB_    0xFF00FF
+		#define BLIT_G_     0x00FF00
+		#define BLIT_LOW_   0x010101
+		#define BLIT_LEVEL_BITS_ 8
+	#endif
+	
+	/* color is moved to low 24 bits for mixing, and alpha put back afterwards */
+	#if BLIT_OUT_DEPTH == SNES_NTSC_ARGB8888
+		#define BLIT_COLOR_SHIFT_ 8
+		#define BLIT_ALPHA_ 0xFF
+	#elif BLIT_OUT_DEPTH == SNES_NTSC_BGRA8888
+		#define BLIT_COLOR_SHIFT_ 0
+		#define BLIT_ALPHA_ 0xFF000000
+	#else
+		#define BLIT_COLOR_SHIFT_ 0
+		#define BLIT_ALPHA_ 0
+	#endif
+	
+	#define BLIT_PARAMS_ , double scanline_level, int blend
+	
+	#define BLIT_PASTE2_( a, b ) a##b
+	#define BLIT_PASTE_( a, b ) BLIT_PASTE2_( a, b )
+	#define BLIT_SCANLINE_ BLIT_PASTE_( BLIT_NAME, _row )
+	
+	/* scanline is darkened by dark / (1 << BLIT_LEVEL_BITS_) */
+	#define BLIT_SETUP_ \
+		snes_ntsc_rgb_t const dark = (scanline_level <= 0 ? 1 << BLIT_LEVEL_BITS_ :\
+				scanline_level >= 1 ? 0 :\
+				(1 << BLIT_LEVEL_BITS_) - (snes_ntsc_rgb_t)\
+				(scanline_level * (1 << BLIT_LEVEL_BITS_) + 0.5));\
+		long scan_offset  = out_pitch; /* from output row to its scanline */\
+		long above_offset = 0;         /* from output row to row mixed with */
+	
+	/* writes scanline for row just output while it's still in cache. When
+	blending, scanline goes between previous row and this one. */
+	#define BLIT_END_ROW_ \
+		BLIT_SCANLINE_( (BLIT_OUT_T*) ((char*) rgb_out + scan_offset),\
+				(BLIT_OUT_T const*) ((char*) rgb_out + above_offset),\
+				(BLIT_OUT_T const*) rgb_out,\
+				(chunk_count + 1) * snes_ntsc_out_chunk * BLIT_OUT_SIZE_, dark );\
+		if ( blend )\
+		{\
+			scan_offset  = -out_pitch;\
+			above_offset = -out_pitch * 2;\
+		}\
+		rgb_out = (char*) rgb_out + out_pitch * 2;
+	
+	/* final scanline has nothing below to blend with */
+	#define BLIT_FINISH_ \
+		if ( above_offset )\
+			BLIT_SCANLINE_( (BLIT_OUT_T*) ((char*) rgb_out - out_pitch),\
+					(BLIT_OUT_T const*) ((char*) rgb_out - out_pitch * 2),\
+					(BLIT_OUT_T const*) ((char*) rgb_out - out_pitch * 2),\
+					(chunk_count + 1) * snes_ntsc_out_chunk * BLIT_OUT_SIZE_, dark );
+#else
+	#if BLIT_PREFETCH
+		#define BLIT_PARAMS_ , int distance
+		/* negative distance would prefetch before start of row */
+		#define BLIT_SETUP_ int const ahead = (distance > 0 ? distance : 0);
+	#else
+		#define BLIT_PARAMS_
+		#define BLIT_SETUP_
+	#endif
+	#define BLIT_END_ROW_ \
+		rgb_out = (char*) rgb_out + out_pitch;
+	#define BLIT_FINISH_
+#endif
+
+#if SNES_NTSC_PROFILE
+	#define BLIT_PROF_BEGIN_ \
+		int const prof_rows_ = (snes_ntsc_prof_begin_(), in_height);
+	#define BLIT_PROF_END_ \
+		snes_ntsc_prof_end_( prof_rows_ );
+#else
+	#define BLIT_PROF_BEGIN_
+	#define BLIT_PROF_END_
+#endif
+
+#if BLIT_SCANLINES
+/* Writes average of above and below rows, rounded down, less dark / (1 <<
+BLIT_LEVEL_BITS_) of it. For RGB888, count is in bytes and each is mixed on its
+own. */
+static void BLIT_SCANLINE_( BLIT_OUT_T* restrict scan, BLIT_OUT_T const* restrict above,
+		BLIT_OUT_T const* restrict below, int count, snes_ntsc_rgb_t dark )
+{
+	int i;
+	if ( !(dark & (dark - 1)) )
+	{
+		/* levels of 1 - 2^-k like 0.875, and 0 and 1, only need a shift rather
+		than two multiplies */
+		int shift = 0;
+		snes_ntsc_rgb_t mask = 0;
+		if ( dark )
+		{
+			while ( dark << shift != 1 << BLIT_LEVEL_BITS_ )
+				shift++;
+			/* keeps bits shifted out of one color from reaching the one below */
+			mask = (BLIT_RB_ >> shift & BLIT_RB_) | (BLIT_G_ >> shift & BLIT_G_);
+		}
+		for ( i = 0; i < count; i++ )
+		{
+			snes_ntsc_rgb_t a = above [i] >> BLIT_COLOR_SHIFT_;
+			snes_ntsc_rgb_t b = below [i] >> BLIT_COLOR_SHIFT_;
+			snes_ntsc_rgb_t mixed = (a & b) + ((a ^ b) & ~BLIT_LOW_) / 2;
+			scan [i] = (BLIT_OUT_T) ((mixed - (mixed >> shift & mask)) << BLIT_COLOR_SHIFT_ |
+					BLIT_ALPHA_);
+		}
+		return;
+	}
+	
+	for ( i = 0; i < count; i++ )
+	{
+		snes_ntsc_rgb_t a = above [i] >> BLIT_COLOR_SHIFT_;
+		snes_ntsc_rgb_t b = below [i] >> BLIT_COLOR_SHIFT_;
+		snes_ntsc_rgb_t mixed = (a & b) + ((a ^ b) & ~BLIT_LOW_) / 2;
+		scan [i] = (BLIT_OUT_T) ((mixed - (((mixed & BLIT_RB_) * dark >> BLIT_LEVEL_BITS_ & BLIT_RB_) |
+				((mixed & BLIT_G_) * dark >> BLIT_LEVEL_BITS_ & BLIT_G_))) << BLIT_COLOR_SHIFT_ |
+				BLIT_ALPHA_);
+	}
+}
+#endif
+
+BLIT_LINKAGE void BLIT_NAME( snes_ntsc_t const* ntsc, BLIT_IN_T const* input, long in_row_width,
+		int burst_phase, int in_width, int in_height, void* rgb_out, long out_pitch
+		BLIT_PARAMS_ )
+{
+	int chunk_count = (in_width - 1) / snes_ntsc_in_chunk;
+	BLIT_SETUP_
+	BLIT_PROF_BEGIN_
+	for ( ; in_height; --in_height )
+	{
+		BLIT_IN_T const* line_in = input;
+		SNES_NTSC_ROW_( ntsc, burst_phase )
+		SNES_NTSC_BEGIN_ROW_6_( snes_ntsc_black, snes_ntsc_black, BLIT_ADJ_IN( *line_in ),
+				BLIT_IN_FORMAT, ktable );
+		BLIT_OUT_T* restrict line_out = (BLIT_OUT_T*) rgb_out;
+		int n;
+		++line_in;
+		
+		for ( n = chunk_count; n; --n )
+		{
+		#if SNES_NTSC_SIMD
+			/* all three pixels are read first, so keep kernels they replace */
+			snes_ntsc_rgb_t const* kernelxx1 = kernelx1;
+			snes_ntsc_rgb_t const* kernelxx2 = kernelx2;
+			COLOR_IN( 0, BLIT_ADJ_IN( line_in [0] ) );
+			COLOR_IN( 1, BLIT_ADJ_IN( line_in [1] ) );
+			COLOR_IN( 2, BLIT_ADJ_IN( line_in [2] ) );
+			{
+				SIMD_CHUNK( raw );
+				SIMD_CLAMP( raw, 1 );
+				SIMD_RGB_OUT( raw, 1, BLIT_OUT_DEPTH );
+				SIMD_STORE( line_out, raw, BLIT_OUT_DEPTH );
+			}
+		#else
+			/* order of input and output pixels must not be altered */
+			COLOR_IN( 0, BLIT_ADJ_IN( line_in [0] ) );
+			SNES_NTSC_RGB_OUT( 0, PIXEL_OUT( 0 ), BLIT_OUT_DEPTH );
+			SNES_NTSC_RGB_OUT( 1, PIXEL_OUT( 1 ), BLIT_OUT_DEPTH );
+			
+			COLOR_IN( 1, BLIT_ADJ_IN( line_in [1] ) );
+			SNES_NTSC_RGB_OUT( 2, PIXEL_OUT( 2 ), BLIT_OUT_DEPTH );
+			SNES_NTSC_RGB_OUT( 3, PIXEL_OUT( 3 ), BLIT_OUT_DEPTH );
+			
+			COLOR_IN( 2, BLIT_ADJ_IN( line_in [2] ) );
+			SNES_NTSC_RGB_OUT( 4, PIXEL_OUT( 4 ), BLIT_OUT_DEPTH );
+			SNES_NTSC_RGB_OUT( 5, PIXEL_OUT( 5 ), BLIT_OUT_DEPTH );
+			SNES_NTSC_RGB_OUT( 6, PIXEL_OUT( 6 ), BLIT_OUT_DEPTH );
+		#endif
+		#if BLIT_PREFETCH
+			/* only pixels this loop will read, so none past end of row */
+			if ( n * 3 > ahead + 2 )
+			{
+				BLIT_PREFETCH_IN_( line_in [ahead    ] );
+				BLIT_PREFETCH_IN_( line_in [ahead + 1] );
+				BLIT_PREFETCH_IN_( line_in [ahead + 2] );
+			}
+		#endif
+			
+			line_in  += 3;
+			line_out += 7 * BLIT_OUT_SIZE_;
+		}
+		
+		/* finish final pixels */
+		COLOR_IN( 0, snes_ntsc_black );
+		SNES_NTSC_RGB_OUT( 0, PIXEL_OUT( 0 ), BLIT_OUT_DEPTH );
+		SNES_NTSC_RGB_OUT( 1, PIXEL_OUT( 1 ), BLIT_OUT_DEPTH );
+		
+		COLOR_IN( 1, snes_ntsc_black );
+		SNES_NTSC_RGB_OUT( 2, PIXEL_OUT( 2 ), BLIT_OUT_DEPTH );
+		SNES_NTSC_RGB_OUT( 3, PIXEL_OUT( 3 ), BLIT_OUT_DEPTH );
+		
+		COLOR_IN( 2, snes_ntsc_black );
+		SNES_NTSC_RGB_OUT( 4, PIXEL_OUT( 4 ), BLIT_OUT_DEPTH );
+		SNES_NTSC_RGB_OUT( 5, PIXEL_OUT( 5 ), BLIT_OUT_DEPTH );
+		SNES_NTSC_RGB_OUT( 6, PIXEL_OUT( 6 ), BLIT_OUT_DEPTH );
+		
+		burst_phase = (burst_phase + 1) % snes_ntsc_burst_count;
+		input += in_row_width;
+		BLIT_END_ROW_
+	}
+	BLIT_FINISH_
+	BLIT_PROF_END_
+}
+
+BLIT_LINKAGE void BLIT_HIRES_NAME( snes_ntsc_t const* ntsc, BLIT_IN_T const* input, long in_row_width,
+		int burst_phase, int in_width, int in_height, void* rgb_out, long out_pitch
+		BLIT_PARAMS_ )
+{
+	int chunk_count = (in_width - 2) / (snes_ntsc_in_chunk * 2);
+	BLIT_SETUP_
+	BLIT_PROF_BEGIN_
+	for ( ; in_height; --in_height )
+	{
+		BLIT_IN_T const* line_in = input;
+		SNES_NTSC_ROW_( ntsc, burst_phase )
+		SNES_NTSC_HIRES_ROW_( snes_ntsc_black, snes_ntsc_black, snes_ntsc_black,
+				BLIT_ADJ_IN( line_in [0] ), BLIT_ADJ_IN( line_in [1] ),
+				BLIT_IN_FORMAT, ktable );
+		BLIT_OUT_T* restrict line_out = (BLIT_OUT_T*) rgb_out;
+		int n;
+		line_in += 2;
+		
+		for ( n = chunk_count; n; --n )
+		{
+		#if SNES_NTSC_SIMD
+			snes_ntsc_rgb_t const* kernelxx1 = kernelx1;
+			snes_ntsc_rgb_t const* kernelxx2 = kernelx2;
+			snes_ntsc_rgb_t const* kernelxx3 = kernelx3;
+			snes_ntsc_rgb_t const* kernelxx4 = kernelx4;
+			snes_ntsc_rgb_t const* kernelxx5 = kernelx5;
+			COLOR_IN( 0, BLIT_ADJ_IN( line_in [0] ) );
+			COLOR_IN( 1, BLIT_ADJ_IN( line_in [1] ) );
+			COLOR_IN( 2, BLIT_ADJ_IN( line_in [2] ) );
+			COLOR_IN( 3, BLIT_ADJ_IN( line_in [3] ) );
+			COLOR_IN( 4, BLIT_ADJ_IN( line_in [4] ) );
+			COLOR_IN( 5, BLIT_ADJ_IN( line_in [5] ) );
+			{
+				SIMD_HIRES_CHUNK( raw );
+				SIMD_CLAMP( raw, 0 );
+				SIMD_RGB_OUT( raw, 0, BLIT_OUT_DEPTH );
+				SIMD_STORE( line_out, raw, BLIT_OUT_DEPTH );
+			}
+		#else
+			/* twice as many input pixels per chunk */
+			COLOR_IN( 0, BLIT_ADJ_IN( line_in [0] ) );
+			SNES_NTSC_HIRES_OUT( 0, PIXEL_OUT( 0 ), BLIT_OUT_DEPTH );
+			
+			COLOR_IN( 1, BLIT_ADJ_IN( line_in [1] ) );
+			SNES_NTSC_HIRES_OUT( 1, PIXEL_OUT( 1 ), BLIT_OUT_DEPTH );
+			
+			COLOR_IN( 2, BLIT_ADJ_IN( line_in [2] ) );
+			SNES_NTSC_HIRES_OUT( 2, PIXEL_OUT( 2 ), BLIT_OUT_DEPTH );
+			
+			COLOR_IN( 3, BLIT_ADJ_IN( line_in [3] ) );
+			SNES_NTSC_HIRES_OUT( 3, PIXEL_OUT( 3 ), BLIT_OUT_DEPTH );
+			
+			COLOR_IN( 4, BLIT_ADJ_IN( line_in [4] ) );
+			SNES_NTSC_HIRES_OUT( 4, PIXEL_OUT( 4 ), BLIT_OUT_DEPTH );
+			
+			COLOR_IN( 5, BLIT_ADJ_IN( line_in [5] ) );
+			SNES_NTSC_HIRES_OUT( 5, PIXEL_OUT( 5 ), BLIT_OUT_DEPTH );
+			SNES_NTSC_HIRES_OUT( 6, PIXEL_OUT( 6 ), BLIT_OUT_DEPTH );
+		#endif
+		#if BLIT_PREFETCH
+			if ( n * 6 > ahead + 5 )
+			{
+				BLIT_PREFETCH_IN_( line_in [ahead    ] );
+				BLIT_PREFETCH_IN_( line_in [ahead + 1] );
+				BLIT_PREFETCH_IN_( line_in [ahead + 2] );
+				BLIT_PREFETCH_IN_( line_in [ahead + 3] );
+				BLIT_PREFETCH_IN_( line_in [ahead + 4] );
+				BLIT_PREFETCH_IN_( line_in [ahead + 5] );
+			}
+		#endif
+			
+			line_in  += 6;
+			line_out += 7 * BLIT_OUT_SIZE_;
+		}
+		
+		COLOR_IN( 0, snes_ntsc_black );
+		SNES_NTSC_HIRES_OUT( 0, PIXEL_OUT( 0 ), BLIT_OUT_DEPTH );
+		
+		COLOR_IN( 1, snes_ntsc_black );
+		SNES_NTSC_HIRES_OUT( 1, PIXEL_OUT( 1 ), BLIT_OUT_DEPTH );
+		
+		COLOR_IN( 2, snes_ntsc_black );
+		SNES_NTSC_HIRES_OUT( 2, PIXEL_OUT( 2 ), BLIT_OUT_DEPTH );
+		
+		COLOR_IN( 3, snes_ntsc_black );
+		SNES_NTSC_HIRES_OUT( 3, PIXEL_OUT( 3 ), BLIT_OUT_DEPTH );
+		
+		COLOR_IN( 4, snes_ntsc_black );
+		SNES_NTSC_HIRES_OUT( 4, PIXEL_OUT( 4 ), BLIT_OUT_DEPTH );
+		
+		COLOR_IN( 5, snes_ntsc_black );
+		SNES_NTSC_HIRES_OUT( 5, PIXEL_OUT( 5 ), BLIT_OUT_DEPTH );
+		SNES_NTSC_HIRES_OUT( 6, PIXEL_OUT( 6 ), BLIT_OUT_DEPTH );
+		
+		burst_phase = (burst_phase + 1) % snes_ntsc_burst_count;
+		input += in_row_width;
+		BLIT_END_ROW_
+	}
+	BLIT_FINISH_
+	BLIT_PROF_END_
+}
+
+#if BLIT_SCANLINES
+	#undef BLIT_RB_
+	#undef BLIT_G_
+	#undef BLIT_LOW_
+	#undef BLIT_LEVEL_BITS_
+	#undef BLIT_COLOR_SHIFT_
+	#undef BLIT_ALPHA_
+	#undef BLIT_PASTE2_
+	#undef BLIT_PASTE_
+	#undef BLIT_SCANLINE_
+#endif
+#undef BLIT_PARAMS_
+#undef BLIT_SETUP_
+#undef BLIT_END_ROW_
+#undef BLIT_FINISH_
+#undef BLIT_PROF_BEGIN_
+#undef BLIT_PROF_END_
+#if BLIT_PREFETCH
+	#undef BLIT_PREFETCH_IN_
+#endif
+#undef BLIT_SCANLINES
+#undef BLIT_PREFETCH
+#undef COLOR_IN
+#undef PIXEL_OUT
+#undef BLIT_OUT_T
+#undef BLIT_OUT_SIZE_
+#undef BLIT_NAME
+#undef BLIT_HIRES_NAME
+#undef BLIT_IN_FORMAT
+#undef BLIT_OUT_DEPTH
@@ -7,12 +7,41 @@
 #define SNES_NTSC_IN_FORMAT SNES_NTSC_RGB16
 /* #define SNES_NTSC_IN_FORMAT SNES_NTSC_BGR15 */
 
+/* Uncomment to generate each table entry the first time a blitter uses it,
+rather than all of them in snes_ntsc_init(). Makes snes_ntsc_init() nearly
+instant, at the cost of a check for each input pixel when blitting. */
+/* #define SNES_NTSC_LAZY 1 */
+
+/* Highest table precision (see snes_ntsc_setup_t) that snes_ntsc_t has room
+for: 10, 12, 13, or 15. Higher precisions are reduced to this. Sets the size of
+snes_ntsc_t to about 0.5, 2, 4, or 16MB respectively (1.125 times that with
+SNES_NTSC_ALIGNED). both_fields needs room for twice the entries, so it only
+takes effect below this; use 15 to have both_fields at 13-bit precision. */
+#define SNES_NTSC_MAX_PRECISION 13
+
 /* The following affect the built-in blitter only; a custom blitter can
 handle things however it wants. */
 
-/* Bits per pixel of output. Can be 15, 16, 32, or 24 (same as 32). */
+/* Bits per pixel of output. Can be 15, 16, 32, or 24 (same as 32), or
+SNES_NTSC_BGRA8888, SNES_NTSC_ARGB8888, or SNES_NTSC_RGB888 for formats with
+opaque alpha or packed 3-byte pixels (see SNES_NTSC_RGB_OUT in snes_ntsc.h). */
 #define SNES_NTSC_OUT_DEPTH 16
 
+/* Uncomment to use SSE2 (1) or AVX2 (2) instructions in the built-in blitters,
+and SSE2 in table generation. Output and table are identical either way.
+Requires a compiler that supports them (e.g. -msse2 or -mavx2 for gcc). */
+/* #define SNES_NTSC_SIMD 1 */
+
+/* Uncomment to store the table so that each input pixel reads a single 64-byte
+cache line, rather than parts of two. Table takes 12.5% more memory: 0.5MB more
+at 13-bit precision, 2MB more at 15-bit. Output is identical. */
+/* #define SNES_NTSC_ALIGNED 1 */
+
+/* Uncomment to have the built-in blitters collect timing and hardware counter
+statistics, read with snes_ntsc_prof_get(). Requires snes_ntsc_prof.c. Costs
+nothing when left commented out. */
+/* #define SNES_NTSC_PROFILE 1 */
+
 /* Type of input pixel values */
 #define SNES_NTSC_IN_T unsigned short
 
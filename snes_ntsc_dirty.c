@@ -0,0 +1,160 @@
+/* snes_ntsc 0.2.2. http://www.slack.net/~ant/ */
+
+/* Incremental blitting of only the rows that changed since the last frame */
+
+#include "snes_ntsc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Copyright (C) 2006-2007 Shay Green. This module is free software; you
+can redistribute it and/or modify it under the terms of the GNU Lesser
+General Public License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version. This
+module is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+details. You should have received a copy of the GNU Lesser General Public
+License along with this module; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
+
+typedef void (*blit_func_t)( snes_ntsc_t const*, SNES_NTSC_IN_T const*, long, int,
+		int, int, void*, long );
+
+struct snes_ntsc_dirty_t
+{
+	int max_width;
+	int max_height;
+	
+	/* what rows in output were last generated with */
+	snes_ntsc_t const* ntsc;
+	blit_func_t blit;
+	int in_width;
+	void* rgb_out;
+	long out_pitch;
+	signed char* phases; /* burst phase of each row, or -1 if row isn't valid */
+	SNES_NTSC_IN_T* rows; /* copy of each row's input */
+};
+
+snes_ntsc_dirty_t* snes_ntsc_dirty_new( int max_width, int max_height )
+{
+	snes_ntsc_dirty_t* d = (snes_ntsc_dirty_t*) malloc( sizeof *d );
+	if ( d )
+	{
+		d->max_width  = max_width;
+		d->max_height = max_height;
+		d->phases = (signed char*) malloc( max_height );
+		d->rows   = (SNES_NTSC_IN_T*) malloc( (size_t) max_width * max_height * sizeof *d->rows );
+		if ( !d->phases || !d->rows )
+		{
+			snes_ntsc_dirty_delete( d );
+			return 0;
+		}
+		snes_ntsc_dirty_reset( d );
+	}
+	return d;
+}
+
+void snes_ntsc_dirty_delete( snes_ntsc_dirty_t* d )
+{
+	if ( d )
+	{
+		free( d->rows );
+		free( d->phases );
+		free( d );
+	}
+}
+
+void snes_ntsc_dirty_reset( snes_ntsc_dirty_t* d )
+{
+	d->ntsc = 0;
+	memset( d->phases, -1, d->max_height );
+}
+
+static int blit_dirty( blit_func_t blit, snes_ntsc_dirty_t* d, snes_ntsc_t const* ntsc,
+		SNES_NTSC_IN_T const* input, long in_row_width, int burst_phase, int in_width,
+		int in_height, void* rgb_out, long out_pitch, unsigned char const* changed )
+{
+	size_t row_size;
+	int skipped = 0;
+	int start = -1; /* first row of run that needs blitting */
+	int row;
+	
+	/* copies of rows only have room for this much */
+	if ( in_width > d->max_width || in_height > d->max_height )
+		return -1;
+	row_size = in_width * sizeof *d->rows;
+	
+	if ( ntsc != d->ntsc || blit != d->blit || in_width != d->in_width ||
+			rgb_out != d->rgb_out || out_pitch != d->out_pitch )
+	{
+		/* nothing in output can be reused */
+		snes_ntsc_dirty_reset( d );
+		d->ntsc      = ntsc;
+		d->blit      = blit;
+		d->in_width  = in_width;
+		d->rgb_out   = rgb_out;
+		d->out_pitch = out_pitch;
+	}
+	
+	for ( row = 0; row <= in_height; row++ )
+	{
+		int need = 0;
+		if ( row < in_height )
+		{
+			int phase = (burst_phase + row) % snes_ntsc_burst_count;
+			SNES_NTSC_IN_T const* in = input + row * in_row_width;
+			SNES_NTSC_IN_T* prev = d->rows + row * d->max_width;
+			
+			if ( changed ? changed [row] : memcmp( prev, in, row_size ) != 0 )
+				need = 1;
+			else if ( d->phases [row] != phase )
+				need = 1;
+			
+			/* keep copy current even when only phase or changed map caused reblit,
+			so that a later call without changed map compares against it */
+			if ( need )
+				memcpy( prev, in, row_size );
+			d->phases [row] = (signed char) phase;
+		}
+		
+		if ( need )
+		{
+			if ( start < 0 )
+				start = row;
+		}
+		else
+		{
+			if ( start >= 0 )
+			{
+				/* blit run of rows ending before this one */
+				blit( ntsc, input + start * in_row_width, in_row_width,
+						(burst_phase + start) % snes_ntsc_burst_count, in_width, row - start,
+						(char*) rgb_out + start * out_pitch, out_pitch );
+				start = -1;
+			}
+			if ( row < in_height )
+				skipped++;
+		}
+	}
+	
+	return skipped;
+}
+
+int snes_ntsc_blit_dirty( snes_ntsc_dirty_t* d, snes_ntsc_t const* ntsc,
+		SNES_NTSC_IN_T const* input, long in_row_width, int burst_phase,
+		int in_width, int in_height, void* rgb_out, long out_pitch,
+		unsigned char const* changed )
+{
+	return blit_dirty( snes_ntsc_blit, d, ntsc, input, in_row_width, burst_phase,
+			in_width, in_height, rgb_out, out_pitch, changed );
+}
+
+int snes_ntsc_blit_hires_dirty( snes_ntsc_dirty_t* d, snes_ntsc_t const* ntsc,
+		SNES_NTSC_IN_T const* input, long in_row_width, int burst_phase,
+		int in_width, int in_height, void* rgb_out, long out_pitch,
+		unsigned char const* changed )
+{
+	return blit_dirty( snes_ntsc_blit_hires, d, ntsc, input, in_row_width, burst_phase,
+			in_width, in_height, rgb_out, out_pitch, changed );
+}
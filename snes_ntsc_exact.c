@@ -0,0 +1,559 @@
+/* snes_ntsc 0.2.2. http://www.slack.net/~ant/ */
+
+/* Filtering to exact aspect ratio, 15 input pixels -> 34 output pixels */
+
+#include "snes_ntsc.h"
+
+#include <stdlib.h>
+
+/* Copyright (C) 2006-2007 Shay Green. This module is free software; you
+can redistribute it and/or modify it under the terms of the GNU Lesser
+General Public License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version. This
+module is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+details. You should have received a copy of the GNU Lesser General Public
+License along with this module; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
+
+/* Same signal processing as snes_ntsc.c, but kernels aren't rescaled there, since
+34:15 has too many phases for that. Each output pixel's position is instead
+interpolated into the kernels when table is generated. */
+#define alignment_count 3
+#define burst_count     3
+#define rescale_in      1
+#define rescale_out     1
+
+#define artifacts_mid   1.0f
+#define fringing_mid    1.0f
+#define std_decoder_hue 0
+
+#define rgb_bits        7
+#define gamma_size      32
+
+#include "snes_ntsc_impl.h"
+
+enum { in_chunk  = snes_ntsc_exact_in_chunk };
+enum { out_chunk = snes_ntsc_exact_out_chunk };
+enum { chunk_samples = in_chunk * 8 / 3 }; /* 3 input pixels -> 8 composite samples */
+
+/* Each of the 15 alignments of an input pixel in a chunk has 14 values, as in
+normal table. Entry is padded to whole 64-byte lines, so that the table index can
+be made the same way as the normal one's. */
+enum { exact_kernel_size = 14 };
+enum { exact_burst_size = in_chunk * exact_kernel_size };
+enum { exact_entry_size = 640 };
+enum { exact_entry_bits = 6 }; /* log2 of bytes per line */
+typedef char exact_entry_fits [exact_burst_size * burst_count <= exact_entry_size ? 1 : -1];
+
+/* Values before table, so that SIMD loads around the first entry's values stay
+within allocated memory */
+enum { exact_table_pad = 16 };
+
+/* First output pixel that input pixel n of chunk adds to, relative to chunk. N
+can be -15 to 29. Pixel's values are centered on it. */
+#define EXACT_START( n ) \
+	((((n) + in_chunk) % in_chunk * out_chunk + out_chunk / 2) / in_chunk -\
+			exact_kernel_size / 2 + ((n) + in_chunk) / in_chunk * out_chunk - out_chunk)
+
+struct snes_ntsc_exact_t
+{
+	snes_ntsc_index_t index; /* lines rather than bytes to entry */
+	int precision;
+	int merge_fields;
+	init_t impl;
+	float taps [in_chunk] [exact_kernel_size] [8]; /* 4 chroma, then 4 luma */
+	snes_ntsc_rgb_t* table;
+};
+
+static void set_index( snes_ntsc_exact_t* e )
+{
+	int const precision = e->precision;
+	int const rb = RED_BITS( precision );
+	int const gb = GREEN_BITS( precision );
+	int const bb = BLUE_BITS( precision );
+	int const entry_bits = exact_entry_bits;
+	
+	e->index.mask [0] = ((1 << rb) - 1) << (entry_bits + gb + bb);
+	e->index.mask [1] = ((1 << gb) - 1) << (entry_bits + bb);
+	e->index.mask [2] = ((1 << bb) - 1) << entry_bits;
+	
+	e->index.rgb16 [0] = (unsigned char) (entry_bits + gb + bb - (16 - rb));
+	e->index.rgb16 [1] = (unsigned char) (entry_bits + bb - (11 - gb));
+	e->index.rgb16 [2] = (unsigned char) (entry_bits - (5 - bb));
+	e->index.bgr15 [0] = (unsigned char) (entry_bits + gb + bb - (5 - rb));
+	e->index.bgr15 [1] = (unsigned char) (entry_bits + bb - (10 - gb));
+	e->index.bgr15 [2] = (unsigned char) ((15 - bb) - entry_bits);
+}
+
+/* Kernel value at fractional position x, linearly interpolated */
+static float interpolate( float const* kernel, float x )
+{
+	int i = (int) floor( x );
+	float frac = x - (float) i;
+	float sum = 0;
+	if ( i >= 0 && i < kernel_size )
+		sum += kernel [i] * (1 - frac);
+	if ( i + 1 >= 0 && i + 1 < kernel_size )
+		sum += kernel [i + 1] * frac;
+	return sum;
+}
+
+/* Kernels at distance of each output pixel from each of the four composite samples
+of the input pixels that add to it */
+static void init_taps( snes_ntsc_exact_t* e )
+{
+	float* out = &e->taps [0] [0] [0];
+	int a;
+	for ( a = 0; a < in_chunk; a++ )
+	{
+		/* first sample of pixel, as in snes_ntsc_pixels */
+		int const sample = a / 3 * 8 + a % 3 * 2;
+		int x;
+		for ( x = EXACT_START( a ); x < EXACT_START( a ) + exact_kernel_size; x++ )
+		{
+			float const center = (x + 0.5f) * chunk_samples / out_chunk - 0.5f;
+			int m;
+			for ( m = 0; m < 4; m++ )
+			{
+				float const pos = kernel_half + (sample + m) - center;
+				out [m    ] = interpolate( e->impl.kernel, pos );
+				out [m + 4] = interpolate( e->impl.kernel + kernel_size, pos );
+			}
+			out += 8;
+		}
+	}
+}
+
+/* Same as gen_kernel(), but for each alignment of the chunk, using its taps */
+static void gen_exact_kernel( snes_ntsc_exact_t const* e, float y, float i, float q,
+		snes_ntsc_rgb_t* out )
+{
+	float const* to_rgb = e->impl.to_rgb;
+	int burst_remain = burst_count;
+	y -= rgb_offset;
+	do
+	{
+		float const* k = &e->taps [0] [0] [0];
+		int a;
+		for ( a = 0; a < in_chunk; a++ )
+		{
+			pixel_info_t const* pixel = &snes_ntsc_pixels [a % alignment_count];
+			
+			float const yy = y * e->impl.fringing * pixel->negate;
+			float const ic0 = (i + yy) * pixel->kernel [0];
+			float const qc1 = (q + yy) * pixel->kernel [1];
+			float const ic2 = (i - yy) * pixel->kernel [2];
+			float const qc3 = (q - yy) * pixel->kernel [3];
+			
+			float const factor = e->impl.artifacts * pixel->negate;
+			float const ii = i * factor;
+			float const yc0 = (y + ii) * pixel->kernel [0];
+			float const yc2 = (y - ii) * pixel->kernel [2];
+			
+			float const qq = q * factor;
+			float const yc1 = (y + qq) * pixel->kernel [1];
+			float const yc3 = (y - qq) * pixel->kernel [3];
+			
+			int n;
+			for ( n = exact_kernel_size; n; --n )
+			{
+				float i = k[0]*ic0 + k[2]*ic2;
+				float q = k[1]*qc1 + k[3]*qc3;
+				float y = k[4]*yc0 + k[5]*yc1 + k[6]*yc2 + k[7]*yc3 + rgb_offset;
+				k += 8;
+				{
+					int r, g, b = YIQ_TO_RGB( y, i, q, to_rgb, int, r, g );
+					*out++ = PACK_RGB( r, g, b ) - rgb_bias;
+				}
+			}
+		}
+		
+		to_rgb += 6;
+		
+		ROTATE_IQ( i, q, -0.866025f, -0.5f ); /* -120 degrees */
+	}
+	while ( --burst_remain );
+}
+
+/* Output pixels of a chunk each have six or seven values added to them, so rather
+than fixed positions as in snes_ntsc.c, each gets its error added to the one nearest
+the center of its kernel */
+static void correct_errors( snes_ntsc_rgb_t color, snes_ntsc_rgb_t* out )
+{
+	int n;
+	for ( n = burst_count; n; --n )
+	{
+		snes_ntsc_rgb_t sum [out_chunk];
+		int nearest [out_chunk]; /* value nearest center so far, and its distance */
+		int distance [out_chunk];
+		int a;
+		for ( a = 0; a < out_chunk; a++ )
+		{
+			sum [a] = 0;
+			distance [a] = exact_kernel_size;
+		}
+		
+		for ( a = 0; a < in_chunk; a++ )
+		{
+			int x = EXACT_START( a ) + out_chunk; /* output pixel of first value */
+			int j;
+			for ( j = 0; j < exact_kernel_size; j++ )
+			{
+				int const i = a * exact_kernel_size + j;
+				int const dist = abs( j * 2 - (exact_kernel_size - 1) );
+				if ( x >= out_chunk )
+					x -= out_chunk;
+				sum [x] += out [i];
+				if ( distance [x] > dist )
+				{
+					distance [x] = dist;
+					nearest  [x] = i;
+				}
+				x++;
+			}
+		}
+		
+		for ( a = 0; a < out_chunk; a++ )
+		{
+			snes_ntsc_rgb_t error = color - sum [a];
+			int const i = nearest [a];
+			CORRECT_ERROR( i );
+		}
+		out += exact_burst_size;
+	}
+}
+
+static void gen_entry( snes_ntsc_exact_t const* e, int entry, snes_ntsc_rgb_t* out )
+{
+	init_t const* impl = &e->impl;
+	int const rb = RED_BITS( e->precision );
+	int const gb = GREEN_BITS( e->precision );
+	int const bb = BLUE_BITS( e->precision );
+	
+	int ir = (entry >> (gb + bb) & ((1 << rb) - 1)) << (5 - rb);
+	int ig = (entry >>       bb  & ((1 << gb) - 1)) << (5 - gb);
+	int ib = (entry              & ((1 << bb) - 1)) << (5 - bb);
+	
+	{
+		float rr = impl->to_float [ir];
+		float gg = impl->to_float [ig];
+		float bb = impl->to_float [ib];
+		
+		float y, i, q = RGB_TO_YIQ( rr, gg, bb, y, i );
+		
+		int r, g, b = YIQ_TO_RGB( y, i, q, impl->to_rgb, int, r, g );
+		snes_ntsc_rgb_t rgb = PACK_RGB( r, g, b );
+		
+		gen_exact_kernel( e, y, i, q, out );
+		if ( e->merge_fields )
+			merge_kernel_fields( out, exact_burst_size );
+		correct_errors( rgb, out );
+	}
+}
+
+typedef struct init_band_t
+{
+	snes_ntsc_exact_t* e;
+	int band_size;
+	int entry_count;
+} init_band_t;
+
+static void init_band( void* data, int index )
+{
+	init_band_t const* b = (init_band_t const*) data;
+	int entry = index * b->band_size;
+	int end = entry + b->band_size;
+	if ( end > b->entry_count )
+		end = b->entry_count;
+	for ( ; entry < end; entry++ )
+		gen_entry( b->e, entry, b->e->table + (long) entry * exact_entry_size );
+}
+
+snes_ntsc_exact_t* snes_ntsc_exact_new( snes_ntsc_setup_t const* setup,
+		snes_ntsc_pool_t* pool )
+{
+	snes_ntsc_exact_t* e;
+	if ( !setup )
+		setup = &snes_ntsc_composite;
+	
+	e = (snes_ntsc_exact_t*) calloc( 1, sizeof *e );
+	if ( !e )
+		return 0;
+	
+	e->precision = snes_ntsc_precision_( setup );
+	e->merge_fields = snes_ntsc_merge_fields_( setup );
+	
+	/* cleared so that padding read by SIMD loads is defined */
+	e->table = (snes_ntsc_rgb_t*) calloc( 1, exact_table_pad * sizeof *e->table +
+			((exact_entry_size * sizeof *e->table) << e->precision) );
+	if ( !e->table )
+	{
+		free( e );
+		return 0;
+	}
+	e->table += exact_table_pad;
+	
+	(void) gen_kernel; /* kernels are generated with taps instead */
+	(void) gather_taps;
+	init( &e->impl, setup );
+	init_taps( e );
+	set_index( e );
+	
+	{
+		int band_count = (pool ? pool->thread_count : 1);
+		init_band_t b;
+		b.e           = e;
+		b.entry_count = 1 << e->precision;
+		b.band_size   = (b.entry_count + band_count - 1) / band_count;
+		if ( band_count > 1 )
+			pool->run( pool, init_band, &b, band_count );
+		else
+			init_band( &b, 0 );
+	}
+	
+	return e;
+}
+
+void snes_ntsc_exact_delete( snes_ntsc_exact_t* e )
+{
+	if ( e )
+	{
+		free( e->table - exact_table_pad );
+		free( e );
+	}
+}
+
+/* blitter */
+
+/* Table index is in lines rather than bytes, and table is always fully generated */
+#undef SNES_NTSC_ENTRY_
+#define SNES_NTSC_ENTRY_( ktable, n ) (snes_ntsc_rgb_t const*) (ktable +\
+	(n) * (exact_entry_size * sizeof (snes_ntsc_rgb_t) >> exact_entry_bits))
+
+#if SNES_NTSC_OUT_DEPTH == SNES_NTSC_RGB888
+	typedef unsigned char exact_out_t;
+	enum { exact_out_size = 3 };
+#elif SNES_NTSC_OUT_DEPTH <= 16
+	typedef snes_ntsc_out16_t exact_out_t;
+	enum { exact_out_size = 1 };
+#else
+	typedef snes_ntsc_out32_t exact_out_t;
+	enum { exact_out_size = 1 };
+#endif
+
+/* Input pixels -3 to 17 of chunk add to its output pixels */
+enum { window_size = 21 };
+
+/* Value that input pixel n of chunk adds to output pixel x of chunk, or 0 if none.
+Condition is constant, so only terms that add something are compiled. */
+#define EXACT_TERM( x, n ) \
+	((unsigned) ((x) - EXACT_START( n )) < exact_kernel_size ?\
+		kernel [(n) + 3] [((n) + in_chunk) % in_chunk * exact_kernel_size +\
+				(x) - EXACT_START( n )] : 0)
+
+#define EXACT_OUT( x ) raw [x] =\
+	EXACT_TERM( x, -3 ) + EXACT_TERM( x, -2 ) + EXACT_TERM( x, -1 ) +\
+	EXACT_TERM( x,  0 ) + EXACT_TERM( x,  1 ) + EXACT_TERM( x,  2 ) +\
+	EXACT_TERM( x,  3 ) + EXACT_TERM( x,  4 ) + EXACT_TERM( x,  5 ) +\
+	EXACT_TERM( x,  6 ) + EXACT_TERM( x,  7 ) + EXACT_TERM( x,  8 ) +\
+	EXACT_TERM( x,  9 ) + EXACT_TERM( x, 10 ) + EXACT_TERM( x, 11 ) +\
+	EXACT_TERM( x, 12 ) + EXACT_TERM( x, 13 ) + EXACT_TERM( x, 14 ) +\
+	EXACT_TERM( x, 15 ) + EXACT_TERM( x, 16 ) + EXACT_TERM( x, 17 )
+
+/* Kernel of input pixel x of chunk, or of black past end of row */
+#define EXACT_PIXEL( x ) ((x) < in_remain ?\
+	SNES_NTSC_IN_FORMAT( ktable, SNES_NTSC_ADJ_IN( line_in [x] ) ) :\
+	(snes_ntsc_rgb_t const*) ktable)
+
+#if SNES_NTSC_SIMD
+	#include "snes_ntsc_simd.h"
+	
+	/* Output pixels of chunk are summed in vectors of exact_lanes. Each input pixel
+	adds a run of 14 values, so a vector that overlaps the run is loaded from the
+	kernel at the same offset and added, with lanes outside the run cleared. Those
+	lanes read the kernel's neighbors in the entry (or the padding before table),
+	so no load leaves the table. Lanes past the chunk's 34 pixels are garbage that
+	isn't stored, so they needn't be cleared. */
+	#if SNES_NTSC_SIMD >= 2
+		typedef __m256i exact_vec_t;
+		enum { exact_lanes = 8 };
+		#define EXACT_VEC_LOAD( p )     _mm256_loadu_si256( (__m256i const*) (p) )
+		#define EXACT_VEC_STORE( p, v ) _mm256_storeu_si256( (__m256i*) (p), v )
+		#define EXACT_VEC_ZERO()        _mm256_setzero_si256()
+		#define EXACT_VEC_ADD( a, b )   _mm256_add_epi32( a, b )
+		#define EXACT_VEC_AND( a, b )   _mm256_and_si256( a, b )
+		#define EXACT_VEC_MASK( v, n ) _mm256_setr_epi32(\
+				-EXACT_KEEP( v, n, 0 ), -EXACT_KEEP( v, n, 1 ), -EXACT_KEEP( v, n, 2 ),\
+				-EXACT_KEEP( v, n, 3 ), -EXACT_KEEP( v, n, 4 ), -EXACT_KEEP( v, n, 5 ),\
+				-EXACT_KEEP( v, n, 6 ), -EXACT_KEEP( v, n, 7 ) )
+		#define EXACT_VEC_FULL( v, n ) (\
+				EXACT_KEEP( v, n, 0 ) && EXACT_KEEP( v, n, 1 ) && EXACT_KEEP( v, n, 2 ) &&\
+				EXACT_KEEP( v, n, 3 ) && EXACT_KEEP( v, n, 4 ) && EXACT_KEEP( v, n, 5 ) &&\
+				EXACT_KEEP( v, n, 6 ) && EXACT_KEEP( v, n, 7 ))
+		
+		/* eight output pixels g * 8 to g * 8 + 7 as simd_t */
+		#define EXACT_VEC_PIXELS( raw, g ) simd_t raw = acc [g];
+	#else
+		typedef __m128i exact_vec_t;
+		enum { exact_lanes = 4 };
+		#define EXACT_VEC_LOAD( p )     _mm_loadu_si128( (__m128i const*) (p) )
+		#define EXACT_VEC_STORE( p, v ) _mm_storeu_si128( (__m128i*) (p), v )
+		#define EXACT_VEC_ZERO()        _mm_setzero_si128()
+		#define EXACT_VEC_ADD( a, b )   _mm_add_epi32( a, b )
+		#define EXACT_VEC_AND( a, b )   _mm_and_si128( a, b )
+		#define EXACT_VEC_MASK( v, n ) _mm_setr_epi32(\
+				-EXACT_KEEP( v, n, 0 ), -EXACT_KEEP( v, n, 1 ),\
+				-EXACT_KEEP( v, n, 2 ), -EXACT_KEEP( v, n, 3 ) )
+		#define EXACT_VEC_FULL( v, n ) (\
+				EXACT_KEEP( v, n, 0 ) && EXACT_KEEP( v, n, 1 ) &&\
+				EXACT_KEEP( v, n, 2 ) && EXACT_KEEP( v, n, 3 ))
+		
+		#define EXACT_VEC_PIXELS( raw, g ) \
+			simd_t raw;\
+			raw.lo = acc [(g) * 2];\
+			raw.hi = acc [(g) * 2 + 1];
+	#endif
+	
+	/* pixels summed for chunk, a whole number of eight-pixel stores */
+	enum { exact_vec_pixels = (out_chunk + 7) / 8 * 8 };
+	enum { exact_vec_count = exact_vec_pixels / exact_lanes };
+	
+	/* Offset of first lane of vector v from start of run of input pixel n */
+	#define EXACT_OFFSET( v, n ) ((v) * exact_lanes - EXACT_START( n ))
+	
+	/* True if lane l of vector v is in run of input pixel n, or is past chunk */
+	#define EXACT_KEEP( v, n, l ) \
+		((unsigned) (EXACT_OFFSET( v, n ) + (l)) < exact_kernel_size ||\
+				(v) * exact_lanes + (l) >= out_chunk)
+	
+	/* Adds run of input pixel n to vector v if they overlap. Conditions are constant,
+	so only the terms that add something are compiled. */
+	#define EXACT_VEC_TERM( v, n ) \
+		if ( (v) * exact_lanes < out_chunk && EXACT_OFFSET( v, n ) > -exact_lanes &&\
+				EXACT_OFFSET( v, n ) < exact_kernel_size )\
+		{\
+			exact_vec_t const in_ = EXACT_VEC_LOAD( kernel [(n) + 3] +\
+					((n) + in_chunk) % in_chunk * exact_kernel_size + EXACT_OFFSET( v, n ) );\
+			acc [v] = EXACT_VEC_ADD( acc [v], EXACT_VEC_FULL( v, n ) ? in_ :\
+					EXACT_VEC_AND( in_, EXACT_VEC_MASK( v, n ) ) );\
+		}
+	
+	#define EXACT_VEC_OUT( v ) if ( (v) < exact_vec_count ) {\
+		acc [v] = EXACT_VEC_ZERO();\
+		EXACT_VEC_TERM( v, -3 ) EXACT_VEC_TERM( v, -2 ) EXACT_VEC_TERM( v, -1 )\
+		EXACT_VEC_TERM( v,  0 ) EXACT_VEC_TERM( v,  1 ) EXACT_VEC_TERM( v,  2 )\
+		EXACT_VEC_TERM( v,  3 ) EXACT_VEC_TERM( v,  4 ) EXACT_VEC_TERM( v,  5 )\
+		EXACT_VEC_TERM( v,  6 ) EXACT_VEC_TERM( v,  7 ) EXACT_VEC_TERM( v,  8 )\
+		EXACT_VEC_TERM( v,  9 ) EXACT_VEC_TERM( v, 10 ) EXACT_VEC_TERM( v, 11 )\
+		EXACT_VEC_TERM( v, 12 ) EXACT_VEC_TERM( v, 13 ) EXACT_VEC_TERM( v, 14 )\
+		EXACT_VEC_TERM( v, 15 ) EXACT_VEC_TERM( v, 16 ) EXACT_VEC_TERM( v, 17 )\
+	}
+	
+	/* clamps, packs, and stores eight output pixels starting at g * 8 */
+	#define EXACT_VEC_STORE_PIXELS( g ) {\
+		EXACT_VEC_PIXELS( raw_, g )\
+		SIMD_CLAMP( raw_, 1 );\
+		SIMD_RGB_OUT( raw_, 1, SNES_NTSC_OUT_DEPTH );\
+		SIMD_STORE( line_out + (g) * 8 * exact_out_size, raw_, SNES_NTSC_OUT_DEPTH );\
+	}
+#endif
+
+void snes_ntsc_exact_blit( snes_ntsc_exact_t const* e, SNES_NTSC_IN_T const* input,
+		long in_row_width, int burst_phase, int in_width, int in_height,
+		void* rgb_out, long out_pitch )
+{
+	int const out_width = SNES_NTSC_EXACT_OUT_WIDTH( in_width );
+	#if SNES_NTSC_PROFILE
+		int const prof_rows = in_height;
+		snes_ntsc_prof_begin_();
+	#endif
+	for ( ; in_height; --in_height )
+	{
+		SNES_NTSC_IN_T const* line_in = input;
+		int in_remain = in_width;
+		snes_ntsc_index_t const snes_ntsc_index_ = e->index;
+		char const* ktable = (char const*) (e->table + burst_phase * exact_burst_size);
+		exact_out_t* restrict line_out = (exact_out_t*) rgb_out;
+		snes_ntsc_rgb_t const* kernel [window_size];
+		int x;
+		int n;
+		
+		/* black before row */
+		for ( n = 0; n < 3; n++ )
+			kernel [n] = (snes_ntsc_rgb_t const*) ktable;
+		for ( ; n < window_size; n++ )
+			kernel [n] = EXACT_PIXEL( n - 3 );
+		
+		for ( x = 0; x < out_width; x += out_chunk )
+		{
+		#if SNES_NTSC_SIMD
+			snes_ntsc_rgb_t raw [exact_vec_pixels];
+			exact_vec_t acc [exact_vec_count];
+		#else
+			snes_ntsc_rgb_t raw [out_chunk];
+		#endif
+			int count = out_width - x;
+			if ( count > out_chunk )
+				count = out_chunk;
+			
+		#if SNES_NTSC_SIMD
+			EXACT_VEC_OUT( 0 ); EXACT_VEC_OUT( 1 ); EXACT_VEC_OUT( 2 );
+			EXACT_VEC_OUT( 3 ); EXACT_VEC_OUT( 4 ); EXACT_VEC_OUT( 5 );
+			EXACT_VEC_OUT( 6 ); EXACT_VEC_OUT( 7 ); EXACT_VEC_OUT( 8 );
+			EXACT_VEC_OUT( 9 );
+			
+			/* stores write 40 pixels, and RGB888 a few bytes more, so near end of
+			row the sums are finished below instead */
+			if ( out_width - x >= exact_vec_pixels + 2 )
+			{
+				EXACT_VEC_STORE_PIXELS( 0 );
+				EXACT_VEC_STORE_PIXELS( 1 );
+				EXACT_VEC_STORE_PIXELS( 2 );
+				EXACT_VEC_STORE_PIXELS( 3 );
+				EXACT_VEC_STORE_PIXELS( 4 );
+				count = 0;
+			}
+			else
+			{
+				for ( n = 0; n < exact_vec_count; n++ )
+					EXACT_VEC_STORE( raw + n * exact_lanes, acc [n] );
+			}
+		#else
+			EXACT_OUT(  0 ); EXACT_OUT(  1 ); EXACT_OUT(  2 ); EXACT_OUT(  3 );
+			EXACT_OUT(  4 ); EXACT_OUT(  5 ); EXACT_OUT(  6 ); EXACT_OUT(  7 );
+			EXACT_OUT(  8 ); EXACT_OUT(  9 ); EXACT_OUT( 10 ); EXACT_OUT( 11 );
+			EXACT_OUT( 12 ); EXACT_OUT( 13 ); EXACT_OUT( 14 ); EXACT_OUT( 15 );
+			EXACT_OUT( 16 ); EXACT_OUT( 17 ); EXACT_OUT( 18 ); EXACT_OUT( 19 );
+			EXACT_OUT( 20 ); EXACT_OUT( 21 ); EXACT_OUT( 22 ); EXACT_OUT( 23 );
+			EXACT_OUT( 24 ); EXACT_OUT( 25 ); EXACT_OUT( 26 ); EXACT_OUT( 27 );
+			EXACT_OUT( 28 ); EXACT_OUT( 29 ); EXACT_OUT( 30 ); EXACT_OUT( 31 );
+			EXACT_OUT( 32 ); EXACT_OUT( 33 );
+		#endif
+			
+			for ( n = 0; n < count; n++ )
+			{
+				snes_ntsc_rgb_t raw_ = raw [n];
+				SNES_NTSC_CLAMP_( raw_, 1 );
+				SNES_NTSC_RGB_OUT_( line_out [n * exact_out_size], SNES_NTSC_OUT_DEPTH, 1 );
+			}
+			line_out += out_chunk * exact_out_size;
+			
+			/* last pixels of this chunk are first of next */
+			for ( n = 0; n < window_size - in_chunk; n++ )
+				kernel [n] = kernel [n + in_chunk];
+			line_in   += in_chunk;
+			in_remain -= in_chunk;
+			for ( ; n < window_size; n++ )
+				kernel [n] = EXACT_PIXEL( n - 3 );
+		}
+		
+		burst_phase = (burst_phase + 1) % snes_ntsc_burst_count;
+		input += in_row_width;
+		rgb_out = (char*) rgb_out + out_pitch;
+	}
+	#if SNES_NTSC_PROFILE
+		snes_ntsc_prof_end_( prof_rows );
+	#endif
+}
@@ -0,0 +1,486 @@
+/* snes_ntsc 0.2.2. http://www.slack.net/~ant/ */
+
+/* Saving and loading of generated tables, and sharing them between processes */
+
+#define _POSIX_C_SOURCE 200112L /* ftruncate() */
+
+#include "snes_ntsc.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined (_WIN32)
+	#define HAVE_MMAP 1
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <sys/file.h>
+#else
+	#include <process.h>
+	#define getpid _getpid
+#endif
+
+/* Copyright (C) 2006-2007 Shay Green. This module is free software; you
+can redistribute it and/or modify it under the terms of the GNU Lesser
+General Public License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version. This
+module is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+details. You should have received a copy of the GNU Lesser General Public
+License along with this module; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
+
+/* Increase whenever generated table contents change */
+enum { table_version = 2 };
+enum { library_version = 0x000202 };
+
+typedef snes_ntsc_rgb_t uint32_; /* always 32 bits */
+
+/* File is this header followed by the snes_ntsc_t exactly as in memory. The
+header is a multiple of 64 bytes so that the table is aligned when mapped. With
+SNES_NTSC_ALIGNED, the table is wherever it falls on a 64-byte boundary. */
+typedef struct header_t
+{
+	char magic [8];
+	uint32_ byte_order;      /* 0x01020304 in native order */
+	uint32_ library_version;
+	uint32_ table_version;
+	uint32_ entry_bits;      /* bits per table value */
+	uint32_ palette_size;
+	uint32_ entry_size;
+	uint32_ object_size;     /* bytes of snes_ntsc_t stored */
+	uint32_ setup_hash [2];
+	uint32_ unused [5];
+} header_t;
+
+static char const magic [8] = { 'S', 'N', 'T', 'S', 'C', 'T', 'B', 'L' };
+
+/* 32-bit FNV-1a, run twice with different starting values */
+static void hash_bytes( uint32_ hash [2], void const* in, size_t size )
+{
+	unsigned char const* p = (unsigned char const*) in;
+	while ( size-- )
+	{
+		hash [0] = (hash [0] ^ *p) * 16777619;
+		hash [1] = (hash [1] ^ *p) * 16777619;
+		p++;
+	}
+}
+
+static void hash_double( uint32_ hash [2], double d )
+{
+	if ( d == 0 )
+		d = 0; /* -0.0 gives same table */
+	hash_bytes( hash, &d, sizeof d );
+}
+
+/* Only entries used at given precision are stored, and table is last */
+static size_t table_size( int precision, int both_fields )
+{
+	return SNES_NTSC_STORED_TABLE_( precision, both_fields );
+}
+
+static size_t stored_size( int precision, int both_fields )
+{
+	return SNES_NTSC_STORED_SIZE_( precision, both_fields );
+}
+
+static void hash_setup( uint32_ hash [2], snes_ntsc_setup_t const* setup, int merge_fields,
+		int precision, int both_fields )
+{
+	static float const no_matrix [6] = { 0 };
+	float const* matrix = (setup->decoder_matrix ? setup->decoder_matrix : no_matrix);
+	int has_matrix = (setup->decoder_matrix != 0);
+	hash [0] = 2166136261u;
+	hash [1] = 0x12345678;
+	hash_double( hash, setup->hue );
+	hash_double( hash, setup->saturation );
+	hash_double( hash, setup->contrast );
+	hash_double( hash, setup->brightness );
+	hash_double( hash, setup->sharpness );
+	hash_double( hash, setup->gamma );
+	hash_double( hash, setup->resolution );
+	hash_double( hash, setup->artifacts );
+	hash_double( hash, setup->fringing );
+	hash_double( hash, setup->bleed );
+	hash_bytes( hash, &merge_fields, sizeof merge_fields );
+	hash_bytes( hash, &precision, sizeof precision );
+	hash_bytes( hash, &both_fields, sizeof both_fields );
+	hash_bytes( hash, &has_matrix, sizeof has_matrix );
+	hash_bytes( hash, matrix, sizeof no_matrix );
+}
+
+static void make_header( header_t* h, snes_ntsc_setup_t const* setup, int merge_fields,
+		int precision, int both_fields )
+{
+	memset( h, 0, sizeof *h );
+	memcpy( h->magic, magic, sizeof h->magic );
+	h->byte_order      = 0x01020304;
+	h->library_version = library_version;
+	h->table_version   = table_version;
+	h->entry_bits      = sizeof (snes_ntsc_rgb_t) * CHAR_BIT;
+	h->palette_size    = snes_ntsc_palette_size;
+	h->entry_size      = snes_ntsc_stored_entry_size;
+	h->object_size     = (uint32_) stored_size( precision, both_fields );
+	hash_setup( h->setup_hash, setup, merge_fields, precision, both_fields );
+}
+
+/* Header of table generated for setup */
+static void setup_header( header_t* h, snes_ntsc_setup_t const* setup )
+{
+	make_header( h, setup, snes_ntsc_merge_fields_( setup ), snes_ntsc_precision_( setup ),
+			snes_ntsc_both_fields_( setup ) );
+}
+
+static char const* check_header( header_t const* h, snes_ntsc_setup_t const* setup )
+{
+	header_t expected;
+	if ( memcmp( h->magic, magic, sizeof magic ) )
+		return "Not a table file";
+	
+	setup_header( &expected, setup );
+	
+	if ( h->byte_order != expected.byte_order || h->entry_bits != expected.entry_bits ||
+			h->palette_size != expected.palette_size || h->entry_size != expected.entry_size )
+		return "Table file is for a different platform or configuration";
+	
+	if ( h->library_version != expected.library_version ||
+			h->table_version != expected.table_version )
+		return "Table file is from a different library version";
+	
+	if ( memcmp( h->setup_hash, expected.setup_hash, sizeof expected.setup_hash ) ||
+			h->object_size != expected.object_size )
+		return "Table file is for different setup";
+	
+	return 0;
+}
+
+/* Table no longer points to caller's memory, and saved setup must be consistent */
+static void fix_loaded( snes_ntsc_t* ntsc )
+{
+	if ( ntsc->saved.setup.decoder_matrix )
+		ntsc->saved.setup.decoder_matrix = ntsc->saved.decoder;
+}
+
+/* distinguishes temporary files of threads in same process */
+static unsigned temp_count;
+
+char const* snes_ntsc_save( snes_ntsc_t const* ntsc, char const* path )
+{
+	header_t h;
+	FILE* out;
+	char* temp;
+	int failed;
+	
+	if ( ntsc->saved.setup.bsnes_colortbl )
+		return "Can't save table made with bsnes_colortbl";
+	
+	#if SNES_NTSC_LAZY
+	{
+		/* file must have complete table, since mapped one can't be modified */
+		int n;
+		for ( n = 0; n < 1 << ntsc->saved.precision; n++ )
+			snes_ntsc_build_entry_( ntsc, n );
+	}
+	#endif
+	
+	make_header( &h, &ntsc->saved.setup, ntsc->saved.merge_fields, ntsc->saved.precision,
+			ntsc->saved.both_fields );
+	
+	/* write to temporary file then rename, so that nobody sees a partial file. Name
+	includes process id so that processes saving at the same time don't collide. */
+	temp = (char*) malloc( strlen( path ) + 32 );
+	if ( !temp )
+		return "Out of memory";
+	sprintf( temp, "%s.%lu.%u.tmp", path, (unsigned long) getpid(), temp_count++ );
+	
+	out = 0;
+	#if HAVE_MMAP
+	{
+		/* fail rather than write through a file that's already there */
+		int fd = open( temp, O_WRONLY | O_CREAT | O_EXCL, 0666 );
+		if ( fd >= 0 && !(out = fdopen( fd, "wb" )) )
+			close( fd );
+	}
+	#else
+		out = fopen( temp, "wb" );
+	#endif
+	if ( !out )
+	{
+		free( temp );
+		return "Couldn't create table file";
+	}
+	
+	{
+		static char const zero [64] = { 0 };
+		int const precision = ntsc->saved.precision;
+		failed = !fwrite( &h, sizeof h, 1, out ) ||
+				!fwrite( ntsc, offsetof (snes_ntsc_t, table), 1, out ) ||
+				fwrite( zero, 1, SNES_NTSC_TABLE_PAD_, out ) != SNES_NTSC_TABLE_PAD_ ||
+				!fwrite( SNES_NTSC_TABLE_( ntsc ),
+						table_size( precision, ntsc->saved.both_fields ), 1, out );
+	}
+	failed |= fclose( out );
+	if ( !failed )
+	{
+		#if defined (_WIN32)
+			remove( path ); /* rename won't replace existing file here */
+		#endif
+		failed = rename( temp, path );
+	}
+	if ( failed )
+		remove( temp );
+	free( temp );
+	
+	return (failed ? "Couldn't write table file" : 0);
+}
+
+char const* snes_ntsc_load( snes_ntsc_t* ntsc, char const* path, snes_ntsc_setup_t const* setup )
+{
+	char const* err = "Table file is truncated";
+	header_t h;
+	FILE* in;
+	if ( !setup )
+		setup = &snes_ntsc_composite;
+	
+	in = fopen( path, "rb" );
+	if ( !in )
+		return "Couldn't open table file";
+	
+	if ( fread( &h, sizeof h, 1, in ) )
+	{
+		err = check_header( &h, setup );
+		if ( !err )
+		{
+			char pad [64]; /* pad in memory can differ from that in file */
+			err = "Table file is truncated";
+			if ( fread( ntsc, offsetof (snes_ntsc_t, table), 1, in ) &&
+					fread( pad, 1, SNES_NTSC_TABLE_PAD_, in ) == SNES_NTSC_TABLE_PAD_ &&
+					fread( (char*) SNES_NTSC_TABLE_( ntsc ), table_size( ntsc->saved.precision,
+							ntsc->saved.both_fields ), 1, in ) && getc( in ) == EOF )
+			{
+				fix_loaded( ntsc );
+				err = 0;
+			}
+		}
+	}
+	fclose( in );
+	return err;
+}
+
+#if HAVE_MMAP
+
+char const* snes_ntsc_map( snes_ntsc_t const** out, char const* path,
+		snes_ntsc_setup_t const* setup )
+{
+	char const* err;
+	size_t size;
+	struct stat st;
+	void* p;
+	int fd;
+	
+	*out = 0;
+	if ( !setup )
+		setup = &snes_ntsc_composite;
+	size = sizeof (header_t) + stored_size( snes_ntsc_precision_( setup ),
+			snes_ntsc_both_fields_( setup ) );
+	
+	fd = open( path, O_RDONLY );
+	if ( fd < 0 )
+		return "Couldn't open table file";
+	
+	if ( fstat( fd, &st ) || (size_t) st.st_size != size )
+	{
+		close( fd );
+		return "Table file is wrong size";
+	}
+	
+	p = mmap( 0, size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if ( p == MAP_FAILED )
+		return "Couldn't map table file";
+	
+	err = check_header( (header_t const*) p, setup );
+	if ( err )
+	{
+		munmap( p, size );
+		return err;
+	}
+	
+	*out = (snes_ntsc_t const*) ((header_t const*) p + 1);
+	return 0;
+}
+
+void snes_ntsc_unmap( snes_ntsc_t const* ntsc )
+{
+	if ( ntsc )
+		munmap( (header_t*) ntsc - 1, sizeof (header_t) +
+				stored_size( ntsc->saved.precision, ntsc->saved.both_fields ) );
+}
+
+/* Shared memory object is laid out as a table file. Its name comes from the
+whole header, so different setups, library versions, and configurations each
+get their own. */
+static void shared_name( char* out, snes_ntsc_setup_t const* setup )
+{
+	header_t h;
+	uint32_ hash [2];
+	setup_header( &h, setup );
+	hash [0] = 2166136261u;
+	hash [1] = 0x12345678;
+	hash_bytes( hash, &h, sizeof h );
+	sprintf( out, "/snes_ntsc-%08lX%08lX", (unsigned long) hash [0], (unsigned long) hash [1] );
+}
+
+char const* snes_ntsc_share( snes_ntsc_t const** out, snes_ntsc_setup_t const* setup )
+{
+	char const* err = 0;
+	char name [32];
+	header_t expected;
+	size_t size;
+	struct stat st;
+	header_t* h;
+	int writable = 1;
+	int fd;
+	
+	*out = 0;
+	if ( !setup )
+		setup = &snes_ntsc_composite;
+	if ( setup->bsnes_colortbl )
+		return "Can't share table made with bsnes_colortbl";
+	
+	setup_header( &expected, setup );
+	size = sizeof (header_t) + expected.object_size;
+	shared_name( name, setup );
+	
+	/* processes that can only read can attach but not generate */
+	fd = shm_open( name, O_RDWR | O_CREAT, 0644 );
+	if ( fd < 0 )
+	{
+		writable = 0;
+		fd = shm_open( name, O_RDONLY, 0 );
+		if ( fd < 0 )
+			return "Couldn't open shared table";
+	}
+	
+	/* Whoever holds the lock and finds the table incomplete generates it. The
+	lock is released if that process dies, and magic is written only once the
+	table is complete, so the next process to attach simply starts over. */
+	if ( flock( fd, LOCK_EX ) || fstat( fd, &st ) )
+	{
+		close( fd );
+		return "Couldn't lock shared table";
+	}
+	
+	if ( (size_t) st.st_size != size && (st.st_size != 0 || !writable ||
+			ftruncate( fd, (off_t) size )) )
+	{
+		close( fd );
+		return (st.st_size ? "Shared table is wrong size" : "Couldn't create shared table");
+	}
+	
+	h = (header_t*) mmap( 0, size, PROT_READ | (writable ? PROT_WRITE : 0),
+			MAP_SHARED, fd, 0 );
+	if ( h == MAP_FAILED )
+	{
+		close( fd );
+		return "Couldn't map shared table";
+	}
+	
+	if ( memcmp( h->magic, magic, sizeof magic ) )
+	{
+		if ( writable )
+		{
+			snes_ntsc_t* ntsc = (snes_ntsc_t*) (h + 1);
+			snes_ntsc_init( ntsc, setup );
+			#if SNES_NTSC_LAZY
+			{
+				/* mapped table can't be modified later */
+				int n;
+				for ( n = 0; n < 1 << ntsc->saved.precision; n++ )
+					snes_ntsc_build_entry_( ntsc, n );
+			}
+			#endif
+			memcpy( (char*) h + sizeof magic, (char const*) &expected + sizeof magic,
+					sizeof expected - sizeof magic );
+			memcpy( h->magic, magic, sizeof magic );
+		}
+		else
+		{
+			err = "Shared table isn't complete";
+		}
+	}
+	else
+	{
+		err = check_header( h, setup );
+	}
+	flock( fd, LOCK_UN );
+	close( fd );
+	
+	/* read-only from now on, like a mapped file */
+	if ( !err && writable && mprotect( h, size, PROT_READ ) )
+		err = "Couldn't map shared table";
+	
+	if ( err )
+	{
+		munmap( h, size );
+		return err;
+	}
+	
+	*out = (snes_ntsc_t const*) (h + 1);
+	return 0;
+}
+
+void snes_ntsc_unshare( snes_ntsc_setup_t const* setup )
+{
+	char name [32];
+	shared_name( name, (setup ? setup : &snes_ntsc_composite) );
+	shm_unlink( name );
+}
+
+#else
+
+/* no memory mapping; load into allocated memory instead */
+char const* snes_ntsc_map( snes_ntsc_t const** out, char const* path,
+		snes_ntsc_setup_t const* setup )
+{
+	char const* err;
+	snes_ntsc_t* ntsc = (snes_ntsc_t*) malloc( sizeof *ntsc );
+	*out = 0;
+	if ( !ntsc )
+		return "Out of memory";
+	
+	err = snes_ntsc_load( ntsc, path, setup );
+	if ( err )
+		free( ntsc );
+	else
+		*out = ntsc;
+	return err;
+}
+
+void snes_ntsc_unmap( snes_ntsc_t const* ntsc )
+{
+	free( (void*) ntsc );
+}
+
+/* no shared memory; each process initializes its own table */
+char const* snes_ntsc_share( snes_ntsc_t const** out, snes_ntsc_setup_t const* setup )
+{
+	snes_ntsc_t* ntsc = (snes_ntsc_t*) malloc( sizeof *ntsc );
+	*out = ntsc;
+	if ( !ntsc )
+		return "Out of memory";
+	snes_ntsc_init( ntsc, setup );
+	return 0;
+}
+
+void snes_ntsc_unshare( snes_ntsc_setup_t const* setup )
+{
+	(void) setup;
+}
+
+#endif
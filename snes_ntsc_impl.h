@@ -47,6 +47,8 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
 enum { burst_size  = snes_ntsc_entry_size / burst_count };
 enum { kernel_half = 16 };
 enum { kernel_size = kernel_half * 2 + 1 };
+enum { rgb_kernel_size = burst_size / alignment_count };
+enum { taps_size = (rgb_kernel_size + 3) & ~3 }; /* rounded up for SIMD */
 
 typedef struct init_t
 {
@@ -57,6 +59,9 @@ typedef struct init_t
 	float artifacts;
 	float fringing;
 	float kernel [rescale_out * kernel_size * 2];
+	/* kernel values used by each output value of each alignment, in the order
+	gen_kernel() needs them: i0, q1, i2, q3, then y0 to y3 */
+	float taps [alignment_count] [8] [taps_size];
 } init_t;
 
 #define ROTATE_IQ( i, q, sin_b, cos_b ) {\
@@ -195,15 +200,12 @@ static void init_filters( init_t* impl, snes_ntsc_setup_t const* setup )
 static float const default_decoder [6] =
 	{ 0.956f, 0.621f, -0.272f, -0.647f, -1.105f, 1.702f };
 
-static void init( init_t* impl, snes_ntsc_setup_t const* setup )
+/* Initialization is split into stages, each depending on only some of the
+setup parameters, so that an update can redo just the ones that changed */
+
+/* artifacts, fringing */
+static void init_artifacts( init_t* impl, snes_ntsc_setup_t const* setup )
 {
-	impl->brightness = (float) setup->brightness * (0.5f * rgb_unit) + rgb_offset;
-	impl->contrast   = (float) setup->contrast   * (0.5f * rgb_unit) + rgb_unit;
-	#ifdef default_palette_contrast
-		if ( !setup->palette )
-			impl->contrast *= default_palette_contrast;
-	#endif
-	
 	impl->artifacts = (float) setup->artifacts;
 	if ( impl->artifacts > 0 )
 		impl->artifacts *= artifacts_max - artifacts_mid;
@@ -213,8 +215,17 @@ static void init( init_t* impl, snes_ntsc_setup_t const* setup )
 	if ( impl->fringing > 0 )
 		impl->fringing *= fringing_max - fringing_mid;
 	impl->fringing = impl->fringing * fringing_mid + fringing_mid;
-	
-	init_filters( impl, setup );
+}
+
+/* brightness, contrast, gamma */
+static void init_levels( init_t* impl, snes_ntsc_setup_t const* setup )
+{
+	impl->brightness = (float) setup->brightness * (0.5f * rgb_unit) + rgb_offset;
+	impl->contrast   = (float) setup->contrast   * (0.5f * rgb_unit) + rgb_unit;
+	#ifdef default_palette_contrast
+		if ( !setup->palette )
+			impl->contrast *= default_palette_contrast;
+	#endif
 	
 	/* generate gamma table */
 	if ( gamma_size > 1 )
@@ -227,7 +238,11 @@ static void init( init_t* impl, snes_ntsc_setup_t const* setup )
 			impl->to_float [i] =
 					(float) pow( i * to_float, gamma ) * impl->contrast + impl->brightness;
 	}
-	
+}
+
+/* hue, saturation, decoder_matrix */
+static void init_decoder( init_t* impl, snes_ntsc_setup_t const* setup )
+{
 	/* setup decoder matricies */
 	{
 		float hue = (float) setup->hue * PI + PI / 180 * ext_decoder_hue;
@@ -268,6 +283,14 @@ static void init( init_t* impl, snes_ntsc_setup_t const* setup )
 	}
 }
 
+static void init( init_t* impl, snes_ntsc_setup_t const* setup )
+{
+	init_artifacts( impl, setup );
+	init_levels( impl, setup );
+	init_filters( impl, setup );
+	init_decoder( impl, setup );
+}
+
 /* kernel generation */
 
 #define RGB_TO_YIQ( r, g, b, y, i ) (\
@@ -284,7 +307,6 @@ static void init( init_t* impl, snes_ntsc_setup_t const* setup )
 
 #define PACK_RGB( r, g, b ) ((r) << 21 | (g) << 11 | (b) << 1)
 
-enum { rgb_kernel_size = burst_size / alignment_count };
 enum { rgb_bias = rgb_unit * 2 * snes_ntsc_rgb_builder };
 
 typedef struct pixel_info_t
@@ -311,8 +333,99 @@ typedef struct pixel_info_t
 
 extern pixel_info_t const snes_ntsc_pixels [alignment_count];
 
+/* Fills impl->taps from kernel. Must be redone whenever init_filters() is. */
+static void gather_taps( init_t* impl )
+{
+	pixel_info_t const* pixel = snes_ntsc_pixels;
+	int a;
+	for ( a = 0; a < alignment_count; a++ )
+	{
+		float (*taps) [taps_size] = impl->taps [a];
+		float const* k = &impl->kernel [pixel->offset];
+		int n;
+		++pixel;
+		for ( n = 0; n < taps_size; n++ )
+		{
+			int m;
+			for ( m = 0; m < 8; m++ )
+				taps [m] [n] = 0; /* padding is processed too, so it must be a number */
+			if ( n >= rgb_kernel_size )
+				continue;
+			
+			for ( m = 0; m < 4; m++ )
+			{
+				taps [m    ] [n] = k [m];
+				taps [m + 4] [n] = k [kernel_size + m];
+			}
+			if ( rescale_out <= 1 )
+				k--;
+			else if ( k < &impl->kernel [kernel_size * 2 * (rescale_out - 1)] )
+				k += kernel_size * 2 - 1;
+			else
+				k -= kernel_size * 2 * (rescale_out - 1) + 2;
+		}
+	}
+}
+
+#if SNES_NTSC_SIMD
+	#include <emmintrin.h>
+	
+	#define TAPS_MUL( m, c ) _mm_mul_ps( _mm_loadu_ps( &k [m] [n] ), c )
+	#define TAPS_RGB( to_rgb ) _mm_cvttps_epi32( _mm_add_ps( _mm_add_ps( y,\
+			_mm_mul_ps( _mm_set1_ps( (to_rgb) [0] ), i ) ), _mm_mul_ps( _mm_set1_ps( (to_rgb) [1] ), q ) ) )
+#endif
+
+/* Generates one alignment's kernel values for one burst phase. SIMD version does
+four at once, with the same operations in the same order, so results are identical. */
+static void gen_taps( float const (*k) [taps_size], float ic0, float qc1, float ic2,
+		float qc3, float yc0, float yc1, float yc2, float yc3, float const* to_rgb,
+		snes_ntsc_rgb_t* out )
+{
+	int n;
+#if SNES_NTSC_SIMD
+	__m128 const ic0_ = _mm_set1_ps( ic0 ), qc1_ = _mm_set1_ps( qc1 );
+	__m128 const ic2_ = _mm_set1_ps( ic2 ), qc3_ = _mm_set1_ps( qc3 );
+	__m128 const yc0_ = _mm_set1_ps( yc0 ), yc1_ = _mm_set1_ps( yc1 );
+	__m128 const yc2_ = _mm_set1_ps( yc2 ), yc3_ = _mm_set1_ps( yc3 );
+	for ( n = 0; n < taps_size; n += 4 )
+	{
+		__m128 const i = _mm_add_ps( TAPS_MUL( 0, ic0_ ), TAPS_MUL( 2, ic2_ ) );
+		__m128 const q = _mm_add_ps( TAPS_MUL( 1, qc1_ ), TAPS_MUL( 3, qc3_ ) );
+		__m128 const y = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_add_ps(
+				TAPS_MUL( 4, yc0_ ), TAPS_MUL( 5, yc1_ ) ), TAPS_MUL( 6, yc2_ ) ),
+				TAPS_MUL( 7, yc3_ ) ), _mm_set1_ps( rgb_offset ) );
+		__m128i const rgb = _mm_sub_epi32( _mm_or_si128( _mm_or_si128(
+				_mm_slli_epi32( TAPS_RGB( to_rgb     ), 21 ),
+				_mm_slli_epi32( TAPS_RGB( to_rgb + 2 ), 11 ) ),
+				_mm_slli_epi32( TAPS_RGB( to_rgb + 4 ),  1 ) ), _mm_set1_epi32( rgb_bias ) );
+		if ( n + 4 <= rgb_kernel_size )
+		{
+			_mm_storeu_si128( (__m128i*) (out + n), rgb );
+		}
+		else
+		{
+			/* padding isn't stored */
+			snes_ntsc_rgb_t last [4];
+			int m;
+			_mm_storeu_si128( (__m128i*) last, rgb );
+			for ( m = n; m < rgb_kernel_size; m++ )
+				out [m] = last [m - n];
+		}
+	}
+#else
+	for ( n = 0; n < rgb_kernel_size; n++ )
+	{
+		float i = k[0][n]*ic0 + k[2][n]*ic2;
+		float q = k[1][n]*qc1 + k[3][n]*qc3;
+		float y = k[4][n]*yc0 + k[5][n]*yc1 + k[6][n]*yc2 + k[7][n]*yc3 + rgb_offset;
+		int r, g, b = YIQ_TO_RGB( y, i, q, to_rgb, int, r, g );
+		out [n] = PACK_RGB( r, g, b ) - rgb_bias;
+	}
+#endif
+}
+
 /* Generate pixel at all burst phases and column alignments */
-static void gen_kernel( init_t* impl, float y, float i, float q, snes_ntsc_rgb_t* out )
+static void gen_kernel( init_t const* impl, float y, float i, float q, snes_ntsc_rgb_t* out )
 {
 	/* generate for each scanline burst phase */
 	float const* to_rgb = impl->to_rgb;
@@ -344,26 +457,10 @@ static void gen_kernel( init_t* impl, float y, float i, float q, snes_ntsc_rgb_t
 			float const yc1 = (y + qq) * pixel->kernel [1];
 			float const yc3 = (y - qq) * pixel->kernel [3];
 			
-			float const* k = &impl->kernel [pixel->offset];
-			int n;
+			gen_taps( impl->taps [pixel - snes_ntsc_pixels], ic0, qc1, ic2, qc3,
+					yc0, yc1, yc2, yc3, to_rgb, out );
+			out += rgb_kernel_size;
 			++pixel;
-			for ( n = rgb_kernel_size; n; --n )
-			{
-				float i = k[0]*ic0 + k[2]*ic2;
-				float q = k[1]*qc1 + k[3]*qc3;
-				float y = k[kernel_size+0]*yc0 + k[kernel_size+1]*yc1 +
-				          k[kernel_size+2]*yc2 + k[kernel_size+3]*yc3 + rgb_offset;
-				if ( rescale_out <= 1 )
-					k--;
-				else if ( k < &impl->kernel [kernel_size * 2 * (rescale_out - 1)] )
-					k += kernel_size * 2 - 1;
-				else
-					k -= kernel_size * 2 * (rescale_out - 1) + 2;
-				{
-					int r, g, b = YIQ_TO_RGB( y, i, q, to_rgb, int, r, g );
-					*out++ = PACK_RGB( r, g, b ) - rgb_bias;
-				}
-			}
 		}
 		while ( alignment_count > 1 && --alignment_remain );
 		
@@ -377,6 +474,32 @@ static void gen_kernel( init_t* impl, float y, float i, float q, snes_ntsc_rgb_t
 	while ( --burst_remain );
 }
 
+#define MERGE_RGB( a, b ) (((a) & (b)) + ((((a) ^ (b)) & ~snes_ntsc_rgb_builder) >> 1))
+
+/* Averages kernels of adjacent burst phases, which are size values apart */
+static void merge_kernel_fields( snes_ntsc_rgb_t* io, int size )
+{
+	int n;
+	for ( n = size; n; --n )
+	{
+		snes_ntsc_rgb_t p0 = io [size * 0] + rgb_bias;
+		snes_ntsc_rgb_t p1 = io [size * 1] + rgb_bias;
+		snes_ntsc_rgb_t p2 = io [size * 2] + rgb_bias;
+		/* merge colors without losing precision; same as
+		(p0 + p1 - ((p0 ^ p1) & snes_ntsc_rgb_builder)) >> 1, but can't overflow */
+		io [size * 0] = MERGE_RGB( p0, p1 ) - rgb_bias;
+		io [size * 1] = MERGE_RGB( p1, p2 ) - rgb_bias;
+		io [size * 2] = MERGE_RGB( p2, p0 ) - rgb_bias;
+		++io;
+	}
+}
+
+/* Bits of red, green, and blue in table entry number, from high to low. Green
+keeps the extra bit at 13 since reducing it was more noticeable. */
+#define RED_BITS( precision )   ((precision) == 15 ? 5 : (precision) == 10 ? 3 : 4)
+#define GREEN_BITS( precision ) ((precision) <= 12 ? 4 : 5)
+#define BLUE_BITS( precision )  RED_BITS( precision )
+
 static void correct_errors( snes_ntsc_rgb_t color, snes_ntsc_rgb_t* out );
 
 #if DISABLE_CORRECTION
@@ -420,20 +543,16 @@ static void correct_errors( snes_ntsc_rgb_t color, snes_ntsc_rgb_t* out );
 
 #include <limits.h>
 
-#if SNES_NTSC_OUT_DEPTH <= 16
-	#if USHRT_MAX == 0xFFFF
-		typedef unsigned short snes_ntsc_out_t;
-	#else
-		#error "Need 16-bit int type"
-	#endif
-
+#if USHRT_MAX == 0xFFFF
+	typedef unsigned short snes_ntsc_out16_t;
 #else
-	#if UINT_MAX == 0xFFFFFFFF
-		typedef unsigned int  snes_ntsc_out_t;
-	#elif ULONG_MAX == 0xFFFFFFFF
-		typedef unsigned long snes_ntsc_out_t;
-	#else
-		#error "Need 32-bit int type"
-	#endif
+	#error "Need 16-bit int type"
+#endif
 
+#if UINT_MAX == 0xFFFFFFFF
+	typedef unsigned int  snes_ntsc_out32_t;
+#elif ULONG_MAX == 0xFFFFFFFF
+	typedef unsigned long snes_ntsc_out32_t;
+#else
+	#error "Need 32-bit int type"
 #endif
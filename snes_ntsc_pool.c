@@ -0,0 +1,156 @@
+/* snes_ntsc 0.2.2. http://www.slack.net/~ant/ */
+
+/* Built-in thread pool for parallel functions. Uses POSIX threads. */
+
+#include "snes_ntsc.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* Copyright (C) 2006-2007 Shay Green. This module is free software; you
+can redistribute it and/or modify it under the terms of the GNU Lesser
+General Public License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version. This
+module is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+details. You should have received a copy of the GNU Lesser General Public
+License along with this module; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
+
+typedef struct pool_t
+{
+	snes_ntsc_pool_t base; /* must be first */
+	pthread_mutex_t run_mutex; /* only one run() at a time */
+	pthread_mutex_t mutex;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	
+	/* current job; protected by mutex */
+	snes_ntsc_task_t task;
+	void* data;
+	int task_count;
+	int next_task;
+	int finished;
+	unsigned long job;
+	int quit;
+	
+	int worker_count;
+	pthread_t workers [1]; /* actually worker_count elements */
+} pool_t;
+
+/* Runs tasks of current job until none are left. Mutex must be locked. */
+static void do_tasks( pool_t* p )
+{
+	while ( p->next_task < p->task_count )
+	{
+		int index = p->next_task++;
+		pthread_mutex_unlock( &p->mutex );
+		p->task( p->data, index );
+		pthread_mutex_lock( &p->mutex );
+		if ( ++p->finished == p->task_count )
+			pthread_cond_broadcast( &p->done );
+	}
+}
+
+static void* worker( void* arg )
+{
+	pool_t* p = (pool_t*) arg;
+	unsigned long job = 0;
+	pthread_mutex_lock( &p->mutex );
+	for ( ;; )
+	{
+		while ( p->job == job && !p->quit )
+			pthread_cond_wait( &p->start, &p->mutex );
+		if ( p->quit )
+			break;
+		job = p->job;
+		do_tasks( p );
+	}
+	pthread_mutex_unlock( &p->mutex );
+	return 0;
+}
+
+static void pool_run( snes_ntsc_pool_t* base, snes_ntsc_task_t task, void* data,
+		int task_count )
+{
+	pool_t* p = (pool_t*) base;
+	pthread_mutex_lock( &p->run_mutex );
+	pthread_mutex_lock( &p->mutex );
+	p->task       = task;
+	p->data       = data;
+	p->task_count = task_count;
+	p->next_task  = 0;
+	p->finished   = 0;
+	p->job++;
+	pthread_cond_broadcast( &p->start );
+	
+	/* calling thread helps rather than sitting idle */
+	do_tasks( p );
+	while ( p->finished < p->task_count )
+		pthread_cond_wait( &p->done, &p->mutex );
+	pthread_mutex_unlock( &p->mutex );
+	pthread_mutex_unlock( &p->run_mutex );
+}
+
+static void stop_workers( pool_t* p, int count )
+{
+	pthread_mutex_lock( &p->mutex );
+	p->quit = 1;
+	pthread_cond_broadcast( &p->start );
+	pthread_mutex_unlock( &p->mutex );
+	while ( count-- )
+		pthread_join( p->workers [count], 0 );
+}
+
+snes_ntsc_pool_t* snes_ntsc_pool_new( int thread_count )
+{
+	pool_t* p;
+	int n;
+	
+	if ( thread_count <= 0 )
+	{
+		long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+		thread_count = (cpus > 0 ? (int) cpus : 1);
+	}
+	
+	p = (pool_t*) calloc( 1, sizeof *p + (thread_count - 1) * sizeof p->workers [0] );
+	if ( !p )
+		return 0;
+	
+	p->base.thread_count = thread_count;
+	p->base.run          = pool_run;
+	p->worker_count      = thread_count - 1; /* calling thread is the other one */
+	pthread_mutex_init( &p->run_mutex, 0 );
+	pthread_mutex_init( &p->mutex, 0 );
+	pthread_cond_init( &p->start, 0 );
+	pthread_cond_init( &p->done, 0 );
+	
+	for ( n = 0; n < p->worker_count; n++ )
+	{
+		if ( pthread_create( &p->workers [n], 0, worker, p ) )
+		{
+			stop_workers( p, n );
+			p->worker_count = 0;
+			snes_ntsc_pool_delete( &p->base );
+			return 0;
+		}
+	}
+	
+	return &p->base;
+}
+
+void snes_ntsc_pool_delete( snes_ntsc_pool_t* base )
+{
+	pool_t* p = (pool_t*) base;
+	if ( p )
+	{
+		stop_workers( p, p->worker_count );
+		pthread_cond_destroy( &p->done );
+		pthread_cond_destroy( &p->start );
+		pthread_mutex_destroy( &p->mutex );
+		pthread_mutex_destroy( &p->run_mutex );
+		free( p );
+	}
+}
@@ -0,0 +1,243 @@
+/* snes_ntsc 0.2.2. http://www.slack.net/~ant/ */
+
+/* Statistics for blitters built with SNES_NTSC_PROFILE. Uses POSIX threads, and
+perf_event_open() for hardware counters on Linux. */
+
+#define _GNU_SOURCE 1 /* syscall() */
+
+#include "snes_ntsc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined (__linux__)
+	#include <unistd.h>
+	#include <sys/syscall.h>
+	#include <linux/perf_event.h>
+	#define PROF_PERF 1
+#endif
+
+#if defined (__GNUC__) && (defined (__i386__) || defined (__x86_64__))
+	#include <x86intrin.h>
+#else
+	#include <time.h>
+#endif
+
+/* Copyright (C) 2006-2007 Shay Green. This module is free software; you
+can redistribute it and/or modify it under the terms of the GNU Lesser
+General Public License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version. This
+module is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+details. You should have received a copy of the GNU Lesser General Public
+License along with this module; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
+
+#if !SNES_NTSC_PROFILE
+	#error "Define SNES_NTSC_PROFILE in snes_ntsc_config.h to use this module"
+#endif
+
+enum { counter_count = 3 }; /* instructions, LLC misses, dTLB misses */
+
+typedef unsigned long long count_t;
+
+/* per-thread state */
+typedef struct thread_t
+{
+	int fd; /* group leader, or -1 if counters aren't available */
+	int members [counter_count - 1];
+	count_t start_time;
+	count_t start [counter_count];
+} thread_t;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static snes_ntsc_prof_t stats; /* protected by mutex */
+static unsigned long counted_calls;
+
+static count_t now( void )
+{
+	#if defined (__GNUC__) && (defined (__i386__) || defined (__x86_64__))
+		return __rdtsc();
+	#else
+		struct timespec t;
+		clock_gettime( CLOCK_MONOTONIC, &t );
+		return (count_t) t.tv_sec * 1000000000 + t.tv_nsec;
+	#endif
+}
+
+#if PROF_PERF
+static int open_counter( unsigned type, __u64 config, int group )
+{
+	struct perf_event_attr attr;
+	memset( &attr, 0, sizeof attr );
+	attr.size           = sizeof attr;
+	attr.type           = type;
+	attr.config         = config;
+	attr.read_format    = PERF_FORMAT_GROUP;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv     = 1;
+	return (int) syscall( __NR_perf_event_open, &attr, 0, -1, group, 0 );
+}
+#endif
+
+/* Opens counters for calling thread. Leaves fd at -1 unless all could be opened. */
+static void open_counters( thread_t* t )
+{
+	t->fd = -1;
+	#if PROF_PERF
+	{
+		int fds [counter_count];
+		int n;
+		fds [0] = open_counter( PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1 );
+		if ( fds [0] < 0 )
+			return;
+		fds [1] = open_counter( PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, fds [0] );
+		fds [2] = open_counter( PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+				(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+				(PERF_COUNT_HW_CACHE_RESULT_MISS << 16), fds [0] );
+		if ( fds [1] < 0 || fds [2] < 0 )
+		{
+			for ( n = counter_count; n--; )
+				if ( fds [n] >= 0 )
+					close( fds [n] );
+			return;
+		}
+		t->fd = fds [0];
+		for ( n = 1; n < counter_count; n++ )
+			t->members [n - 1] = fds [n];
+	}
+	#endif
+}
+
+/* Reads current counter values into out. False if they couldn't be read. */
+static int read_counters( thread_t const* t, count_t* out )
+{
+	#if PROF_PERF
+		__u64 buf [1 + counter_count];
+		int i;
+		if ( read( t->fd, buf, sizeof buf ) != (ssize_t) sizeof buf || buf [0] != counter_count )
+			return 0;
+		for ( i = 0; i < counter_count; i++ )
+			out [i] = buf [1 + i];
+		return 1;
+	#else
+		(void) t;
+		(void) out;
+		return 0;
+	#endif
+}
+
+static void close_counters( thread_t* t )
+{
+	#if PROF_PERF
+		if ( t->fd >= 0 )
+		{
+			int n;
+			for ( n = 0; n < counter_count - 1; n++ )
+				close( t->members [n] );
+			close( t->fd );
+		}
+	#endif
+	t->fd = -1;
+}
+
+static void close_thread( void* arg )
+{
+	close_counters( (thread_t*) arg );
+	free( arg );
+}
+
+static void make_key( void )
+{
+	pthread_key_create( &key, close_thread );
+}
+
+static thread_t* get_thread( void )
+{
+	thread_t* t;
+	pthread_once( &once, make_key );
+	t = (thread_t*) pthread_getspecific( key );
+	if ( !t )
+	{
+		t = (thread_t*) malloc( sizeof *t );
+		if ( !t )
+			return 0;
+		open_counters( t );
+		pthread_setspecific( key, t );
+	}
+	return t;
+}
+
+void snes_ntsc_prof_begin_( void )
+{
+	thread_t* t = get_thread();
+	if ( t )
+	{
+		if ( t->fd >= 0 && !read_counters( t, t->start ) )
+			close_counters( t );
+		t->start_time = now(); /* last, so counter read isn't timed */
+	}
+}
+
+void snes_ntsc_prof_end_( int rows )
+{
+	count_t end_time = now();
+	count_t end [counter_count];
+	thread_t* t = (thread_t*) pthread_getspecific( key );
+	int counted;
+	double cycles;
+	int bucket;
+	if ( !t )
+		return;
+	
+	counted = t->fd >= 0 && read_counters( t, end );
+	cycles = (double) (end_time - t->start_time);
+	
+	/* histogram of cycles per row */
+	bucket = 0;
+	if ( rows > 0 )
+	{
+		count_t per_row = (end_time - t->start_time) / (unsigned) rows;
+		while ( per_row > 1 && bucket < snes_ntsc_prof_buckets - 1 )
+		{
+			per_row >>= 1;
+			bucket++;
+		}
+	}
+	
+	pthread_mutex_lock( &mutex );
+	stats.calls++;
+	stats.rows += rows;
+	stats.cycles += cycles;
+	stats.histogram [bucket]++;
+	if ( counted )
+	{
+		counted_calls++;
+		stats.instructions += (double) (end [0] - t->start [0]);
+		stats.llc_misses   += (double) (end [1] - t->start [1]);
+		stats.dtlb_misses  += (double) (end [2] - t->start [2]);
+	}
+	pthread_mutex_unlock( &mutex );
+}
+
+void snes_ntsc_prof_get( snes_ntsc_prof_t* out )
+{
+	pthread_mutex_lock( &mutex );
+	*out = stats;
+	
+	/* counter totals are only meaningful if every call was counted */
+	out->has_counters = stats.calls && counted_calls == stats.calls;
+	pthread_mutex_unlock( &mutex );
+}
+
+void snes_ntsc_prof_reset( void )
+{
+	pthread_mutex_lock( &mutex );
+	memset( &stats, 0, sizeof stats );
+	counted_calls = 0;
+	pthread_mutex_unlock( &mutex );
+}
@@ -0,0 +1,254 @@
+/* snes_ntsc 0.2.2. http://www.slack.net/~ant/ */
+
+/* SSE2 and AVX2 versions of inner blitter loops, selected by SNES_NTSC_SIMD */
+
+/* Copyright (C) 2006-2007 Shay Green. This module is free software; you
+can redistribute it and/or modify it under the terms of the GNU Lesser
+General Public License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version. This
+module is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+details. You should have received a copy of the GNU Lesser General Public
+License along with this module; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
+
+/* Each input pixel adds 14 consecutive kernel values to 14 consecutive output
+pixels, so output pixel x of a chunk (0 to 6) is a sum of contiguous runs:
+	
+	sum over slots s of  prev [base + 7 + x] + (x < t ? prev2 [base + 14 + x] : kernel [base + x])
+
+where kernel, prev and prev2 are the current, previous and second previous
+kernels of slot s (kernelN, kernelxN, and kernelxN before SNES_NTSC_COLOR_IN).
+	
+	low-res slot: 0  1  2         hires slot: 0  1  2  3  4  5
+	        base: 0 12 24                 base: 0 -1 12 11 24 23
+	           t: 0  2  4                    t: 0  1  2  3  4  5
+
+This lets several output pixels be summed, clamped, and packed at once. Each
+chunk computes an eighth pixel that's garbage, which the next chunk overwrites,
+so the final chunk of each row is left to the normal macros. Loads never go
+beyond the 42 values a burst uses, so they stay within the table. */
+
+#if SNES_NTSC_SIMD >= 2
+	#include <immintrin.h>
+	
+	typedef __m256i simd_t;
+	#define SIMD_LOAD( k, i )   _mm256_loadu_si256( (simd_t const*) ((k) + (i)) )
+	#define SIMD_SET1( n )      _mm256_set1_epi32( (int) (n) )
+	#define SIMD_ADD( a, b )    _mm256_add_epi32( a, b )
+	#define SIMD_SUB( a, b )    _mm256_sub_epi32( a, b )
+	#define SIMD_AND( a, b )    _mm256_and_si256( a, b )
+	#define SIMD_OR( a, b )     _mm256_or_si256( a, b )
+	#define SIMD_SRL( a, n )    _mm256_srli_epi32( a, n )
+	#define SIMD_SLL( a, n )    _mm256_slli_epi32( a, n )
+	
+	/* lanes below t come from second previous kernel, the rest from current one */
+	#define SIMD_LOW_MASK( t ) _mm256_setr_epi32( \
+			-(0 < t), -(1 < t), -(2 < t), -(3 < t), -(4 < t), -(5 < t), -(6 < t), 0 )
+	
+	/* Masked load of lanes 0 to t-1; when t >= 4 those can extend past end of table */
+	#define SIMD_LOAD_LOW( k, i, t ) \
+		_mm256_maskload_epi32( (int const*) ((k) + (i)), SIMD_LOW_MASK( t ) )
+	
+	#define SIMD_SLOT( t, base, kernel, kernelx, kernelxx ) \
+		SIMD_ADD( SIMD_LOAD( kernelx, base + 7 ), _mm256_blend_epi32( \
+				SIMD_LOAD( kernel, base ), SIMD_LOAD_LOW( kernelxx, base + 14, t ), \
+				(1 << t) - 1 ) )
+	
+	/* sum for low-res chunk */
+	#define SIMD_CHUNK( raw ) \
+		simd_t raw = SIMD_ADD( SIMD_ADD(\
+			SIMD_ADD( SIMD_LOAD( kernel0, 0 ), SIMD_LOAD( kernelx0, 7 ) ),\
+			SIMD_SLOT( 2, 12, kernel1, kernelx1, kernelxx1 ) ),\
+			SIMD_SLOT( 4, 24, kernel2, kernelx2, kernelxx2 ) )
+	
+	/* sum for hires chunk; slot 1 starts one before kernel1, so shift it up a lane */
+	#define SIMD_HIRES_CHUNK( raw ) \
+		simd_t raw = SIMD_ADD( SIMD_ADD( SIMD_ADD( SIMD_ADD( SIMD_ADD( SIMD_ADD( SIMD_ADD(\
+			SIMD_LOAD( kernel0, 0 ), SIMD_LOAD( kernelx0, 7 ) ),\
+			SIMD_LOAD( kernelx1, 6 ) ),\
+			_mm256_blend_epi32( _mm256_permutevar8x32_epi32( SIMD_LOAD( kernel1, 0 ),\
+					_mm256_setr_epi32( 0, 0, 1, 2, 3, 4, 5, 6 ) ),\
+					SIMD_LOAD( kernelxx1, 13 ), 1 ) ),\
+			SIMD_SLOT( 2, 12, kernel2, kernelx2, kernelxx2 ) ),\
+			SIMD_SLOT( 3, 11, kernel3, kernelx3, kernelxx3 ) ),\
+			SIMD_SLOT( 4, 24, kernel4, kernelx4, kernelxx4 ) ),\
+			SIMD_SLOT( 5, 23, kernel5, kernelx5, kernelxx5 ) )
+	
+	/* RGB888 takes bytes R, G, B of each 0x00RRGGBB pixel. Four pixels of each
+	half are 12 bytes, so the second half's store overlaps the first's by four,
+	and writes four bytes past the eighth pixel, which the next chunk or final
+	pixels overwrite like the eighth. */
+	#define SIMD_STORE( out, raw, bits ) {\
+		if ( bits <= 16 )\
+		{\
+			__m256i packed_ = _mm256_permute4x64_epi64( _mm256_packus_epi32( raw, raw ), 0xD8 );\
+			_mm_storeu_si128( (__m128i*) (out), _mm256_castsi256_si128( packed_ ) );\
+		}\
+		else if ( bits == SNES_NTSC_RGB888 )\
+		{\
+			__m256i packed_ = _mm256_shuffle_epi8( raw, _mm256_setr_epi8(\
+					2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,\
+					2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1 ) );\
+			_mm_storeu_si128( (__m128i*) (out), _mm256_castsi256_si128( packed_ ) );\
+			_mm_storeu_si128( (__m128i*) ((unsigned char*) (out) + 12),\
+					_mm256_extracti128_si256( packed_, 1 ) );\
+		}\
+		else\
+		{\
+			_mm256_storeu_si256( (simd_t*) (out), raw );\
+		}\
+	}
+
+#else
+	#include <emmintrin.h>
+	
+	/* Pixels 0-3 of a chunk are in lo and 4-7 in hi */
+	typedef struct simd_t { __m128i lo, hi; } simd_t;
+	
+	#define SIMD_LOAD_( k, i )   _mm_loadu_si128( (__m128i const*) ((k) + (i)) )
+	#define SIMD_MASK_( t )      _mm_setr_epi32( -(0 < t), -(1 < t), -(2 < t), -(3 < t) )
+	#define SIMD_SELECT_( t, a, b ) \
+		_mm_or_si128( _mm_and_si128( SIMD_MASK_( t ), a ), _mm_andnot_si128( SIMD_MASK_( t ), b ) )
+	
+	#define SIMD_SET1( n ) simd_set1_( (int) (n) )
+	#define SIMD_BINARY_( name, op ) \
+		static simd_t name( simd_t a, simd_t b ) {\
+			simd_t r;\
+			r.lo = op( a.lo, b.lo );\
+			r.hi = op( a.hi, b.hi );\
+			return r;\
+		}
+	SIMD_BINARY_( simd_sub_, _mm_sub_epi32 )
+	SIMD_BINARY_( simd_and_, _mm_and_si128 )
+	SIMD_BINARY_( simd_or_,  _mm_or_si128 )
+	#define SIMD_SUB( a, b ) simd_sub_( a, b )
+	#define SIMD_AND( a, b ) simd_and_( a, b )
+	#define SIMD_OR( a, b )  simd_or_( a, b )
+	
+	static simd_t simd_set1_( int n )
+	{
+		simd_t r;
+		r.lo = r.hi = _mm_set1_epi32( n );
+		return r;
+	}
+	
+	/* shift counts must be constant, so these can't be functions */
+	#define SIMD_SRL( a, n ) simd_shift_( a, _mm_srli_epi32( a.lo, n ), _mm_srli_epi32( a.hi, n ) )
+	#define SIMD_SLL( a, n ) simd_shift_( a, _mm_slli_epi32( a.lo, n ), _mm_slli_epi32( a.hi, n ) )
+	static simd_t simd_shift_( simd_t a, __m128i lo, __m128i hi )
+	{
+		a.lo = lo;
+		a.hi = hi;
+		return a;
+	}
+	
+	#define SIMD_CHUNK( raw ) \
+		simd_t raw;\
+		raw.lo = _mm_add_epi32( _mm_add_epi32( _mm_add_epi32(\
+				_mm_add_epi32( SIMD_LOAD_( kernel0, 0 ), SIMD_LOAD_( kernelx0, 7 ) ),\
+				_mm_add_epi32( SIMD_LOAD_( kernelx1, 19 ), SIMD_LOAD_( kernelx2, 31 ) ) ),\
+				SIMD_SELECT_( 2, SIMD_LOAD_( kernelxx1, 26 ), SIMD_LOAD_( kernel1, 12 ) ) ),\
+				SIMD_LOAD_( kernelxx2, 38 ) );\
+		raw.hi = _mm_add_epi32( _mm_add_epi32( _mm_add_epi32(\
+				_mm_add_epi32( SIMD_LOAD_( kernel0, 4 ), SIMD_LOAD_( kernelx0, 11 ) ),\
+				_mm_add_epi32( SIMD_LOAD_( kernelx1, 23 ), SIMD_LOAD_( kernelx2, 35 ) ) ),\
+				SIMD_LOAD_( kernel1, 16 ) ),\
+				SIMD_LOAD_( kernel2, 28 ) )
+	
+	/* slot 1 starts one before kernel1 and slot 5 needs one value past 40 of
+	kernelxx5, so those are shifted into place */
+	#define SIMD_HIRES_CHUNK( raw ) \
+		simd_t raw;\
+		raw.lo = _mm_add_epi32( _mm_add_epi32( _mm_add_epi32( _mm_add_epi32( _mm_add_epi32(\
+				_mm_add_epi32( SIMD_LOAD_( kernel0, 0 ), SIMD_LOAD_( kernelx0, 7 ) ),\
+				_mm_add_epi32( SIMD_LOAD_( kernelx1, 6 ), SIMD_LOAD_( kernelx2, 19 ) ) ),\
+				_mm_add_epi32( SIMD_LOAD_( kernelx3, 18 ), SIMD_LOAD_( kernelx4, 31 ) ) ),\
+				_mm_add_epi32( SIMD_LOAD_( kernelx5, 30 ), SIMD_LOAD_( kernelxx4, 38 ) ) ),\
+				_mm_add_epi32( SIMD_LOAD_( kernelxx5, 37 ),\
+						_mm_or_si128( _mm_slli_si128( SIMD_LOAD_( kernel1, 0 ), 4 ),\
+								_mm_and_si128( SIMD_MASK_( 1 ), SIMD_LOAD_( kernelxx1, 13 ) ) ) ) ),\
+				_mm_add_epi32(\
+						SIMD_SELECT_( 2, SIMD_LOAD_( kernelxx2, 26 ), SIMD_LOAD_( kernel2, 12 ) ),\
+						SIMD_SELECT_( 3, SIMD_LOAD_( kernelxx3, 25 ), SIMD_LOAD_( kernel3, 11 ) ) ) );\
+		raw.hi = _mm_add_epi32( _mm_add_epi32( _mm_add_epi32( _mm_add_epi32( _mm_add_epi32(\
+				_mm_add_epi32( SIMD_LOAD_( kernel0, 4 ), SIMD_LOAD_( kernelx0, 11 ) ),\
+				_mm_add_epi32( SIMD_LOAD_( kernelx1, 10 ), SIMD_LOAD_( kernelx2, 23 ) ) ),\
+				_mm_add_epi32( SIMD_LOAD_( kernelx3, 22 ), SIMD_LOAD_( kernelx4, 35 ) ) ),\
+				_mm_add_epi32( SIMD_LOAD_( kernelx5, 34 ), SIMD_LOAD_( kernel1, 3 ) ) ),\
+				_mm_add_epi32( SIMD_LOAD_( kernel2, 16 ), SIMD_LOAD_( kernel3, 15 ) ) ),\
+				_mm_add_epi32( SIMD_LOAD_( kernel4, 28 ),\
+						_mm_or_si128( _mm_srli_si128( SIMD_LOAD_( kernelxx5, 38 ), 12 ),\
+								_mm_andnot_si128( SIMD_MASK_( 1 ), SIMD_LOAD_( kernel5, 27 ) ) ) ) )
+	
+	/* sign-extend low 16 bits so that signed pack doesn't saturate them */
+	#define SIMD_PACK16_( v ) _mm_srai_epi32( _mm_slli_epi32( v, 16 ), 16 )
+	
+	/* SSE2 has no byte shuffle, so four 0x00RRGGBB pixels are made into 12 bytes
+	R, G, B by swapping red and blue, closing the gaps within each 64-bit half,
+	then moving the upper half down against the lower one */
+	static __m128i simd_rgb888_( __m128i v )
+	{
+		__m128i const low24 = _mm_set_epi32( 0, 0xFFFFFF, 0, 0xFFFFFF );
+		v = _mm_or_si128( _mm_or_si128(
+				_mm_and_si128( _mm_srli_epi32( v, 16 ), _mm_set1_epi32( 0xFF ) ),
+				_mm_and_si128( v, _mm_set1_epi32( 0xFF00 ) ) ),
+				_mm_and_si128( _mm_slli_epi32( v, 16 ), _mm_set1_epi32( 0xFF0000 ) ) );
+		v = _mm_or_si128( _mm_and_si128( v, low24 ), _mm_srli_epi64( _mm_andnot_si128( low24, v ), 8 ) );
+		return _mm_or_si128( _mm_move_epi64( v ), _mm_slli_si128( _mm_srli_si128( v, 8 ), 6 ) );
+	}
+	
+	#define SIMD_STORE( out, raw, bits ) {\
+		if ( bits <= 16 )\
+		{\
+			_mm_storeu_si128( (__m128i*) (out),\
+					_mm_packs_epi32( SIMD_PACK16_( raw.lo ), SIMD_PACK16_( raw.hi ) ) );\
+		}\
+		else if ( bits == SNES_NTSC_RGB888 )\
+		{\
+			_mm_storeu_si128( (__m128i*) (out), simd_rgb888_( raw.lo ) );\
+			_mm_storeu_si128( (__m128i*) ((unsigned char*) (out) + 12), simd_rgb888_( raw.hi ) );\
+		}\
+		else\
+		{\
+			_mm_storeu_si128( (__m128i*) (out), raw.lo );\
+			_mm_storeu_si128( (__m128i*) (out) + 1, raw.hi );\
+		}\
+	}
+
+#endif
+
+/* vector versions of SNES_NTSC_CLAMP_ and SNES_NTSC_RGB_OUT_ */
+#define SIMD_CLAMP( io, shift ) {\
+	simd_t sub = SIMD_AND( SIMD_SRL( io, 9-(shift) ), SIMD_SET1( snes_ntsc_clamp_mask ) );\
+	simd_t clamp = SIMD_SUB( SIMD_SET1( snes_ntsc_clamp_add ), sub );\
+	io = SIMD_OR( io, clamp );\
+	clamp = SIMD_SUB( clamp, sub );\
+	io = SIMD_AND( io, clamp );\
+}
+
+#define SIMD_SHIFT_MASK_( raw, shift, mask ) \
+	SIMD_AND( SIMD_SRL( raw, shift ), SIMD_SET1( mask ) )
+
+#define SIMD_RGB_OUT( raw, x, bits ) {\
+	if ( bits == 16 )\
+		raw = SIMD_OR( SIMD_OR( SIMD_SHIFT_MASK_( raw, 13-x, 0xF800 ),\
+				SIMD_SHIFT_MASK_( raw, 8-x, 0x07E0 ) ), SIMD_SHIFT_MASK_( raw, 4-x, 0x001F ) );\
+	if ( bits == 24 || bits == 32 || bits == SNES_NTSC_BGRA8888 || bits == SNES_NTSC_RGB888 )\
+		raw = SIMD_OR( SIMD_OR( SIMD_SHIFT_MASK_( raw, 5-x, 0xFF0000 ),\
+				SIMD_SHIFT_MASK_( raw, 3-x, 0xFF00 ) ), SIMD_SHIFT_MASK_( raw, 1-x, 0xFF ) );\
+	if ( bits == SNES_NTSC_BGRA8888 )\
+		raw = SIMD_OR( raw, SIMD_SET1( 0xFF000000 ) );\
+	if ( bits == SNES_NTSC_ARGB8888 )\
+		raw = SIMD_OR( SIMD_OR( SIMD_OR( SIMD_AND( SIMD_SLL( raw, 23+x ), SIMD_SET1( 0xFF000000 ) ),\
+				SIMD_AND( SIMD_SLL( raw, 5+x ), SIMD_SET1( 0xFF0000 ) ) ),\
+				SIMD_SHIFT_MASK_( raw, 13-x, 0xFF00 ) ), SIMD_SET1( 0xFF ) );\
+	if ( bits == 15 )\
+		raw = SIMD_OR( SIMD_OR( SIMD_SHIFT_MASK_( raw, 14-x, 0x7C00 ),\
+				SIMD_SHIFT_MASK_( raw, 9-x, 0x03E0 ) ), SIMD_SHIFT_MASK_( raw, 4-x, 0x001F ) );\
+	if ( bits == 14 )\
+		raw = SIMD_OR( SIMD_OR( SIMD_SHIFT_MASK_( raw, 24-x, 0x001F ),\
+				SIMD_SHIFT_MASK_( raw, 9-x, 0x03E0 ) ),\
+				SIMD_AND( SIMD_SLL( raw, 6+x ), SIMD_SET1( 0x7C00 ) ) );\
+}